@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <thread>
+#include "async-promise/promise.hpp"
+#include "test_util.hpp"
+using namespace promise;
+// Built with PROMISE_DEBUG_ALLOC=ON; fails when an operation exceeds its allocation budget.
+static void check(const std::string &name, size_t budget, const std::function<void()> &op) {
+    AllocStats before = DebugAlloc::thread();
+    op();
+    AllocStats used = DebugAlloc::thread() - before;
+    if (used.allocations() > budget)
+        printf("%s used %zu allocations, budget %zu\n", name.c_str(), used.allocations(), budget);
+    expect(used.allocations() <= budget, (name + " stays within its allocation budget").c_str());
+    expect(used.liveBytes() == 0, (name + " frees what it allocates").c_str());
+}
+int main() {
+    check("newPromise+resolve", 12, []() {
+        Promise promise = newPromise([](Defer &defer) {
+            defer.resolve(1);
+        });
+    });
+    check("newPromise+then+deferred resolve", 19, []() {
+        Defer *saved = nullptr;
+        Promise promise = newPromise([&saved](Defer &defer) {
+            saved = new Defer(defer);
+        });
+        promise.then([](int value) {
+            return value + 1;
+        });
+        saved->resolve(1);
+        delete saved;
+    });
+    check("lazyPromise dropped unused", 1, []() {
+        Promise promise = lazyPromise([](Defer &defer) {
+            defer.resolve(1);
+        });
+    });
+
+    // A promise released on another thread is freed there.
+    AllocStats before = DebugAlloc::thread();
+    Promise moved = resolve(1);
+    AllocStats freedThere;
+    std::thread releaser([&moved, &freedThere]() {
+        AllocStats start = DebugAlloc::thread();
+        moved = Promise();
+        freedThere = DebugAlloc::thread() - start;
+    });
+    releaser.join();
+    AllocStats here = DebugAlloc::thread() - before;
+    expect(here.liveBytes() > 0 && here.liveBytes() + freedThere.liveBytes() == 0, "frees are counted on the freeing thread");
+    return report();
+}
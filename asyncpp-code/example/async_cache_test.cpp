@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string>
+#include "async-promise/promise.hpp"
+#include "async-promise/single_flight.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "extensions/task_scheduler/async_cache.hpp"
+#include "test_util.hpp"
+using namespace promise;
+int main() {
+    Service service;
+    int backendCalls = 0;
+    auto backend = [&service, &backendCalls](int key) {
+        return [&service, &backendCalls, key]() {
+            ++backendCalls;
+            return service.delay(20).then([key]() {
+                return "value" + std::to_string(key);
+            });
+        };
+    };
+
+    // Ten concurrent lookups of one key share one backend call.
+    SingleFlight<int> flights;
+    int results = 0;
+    for (int i = 0; i < 10; ++i) {
+        flights.run(1, backend(1)).then([&results](const std::string &value) {
+            if (value == "value1") ++results;
+        });
+    }
+    expect(flights.inFlight(1), "call is in flight");
+    service.run();
+    expect(backendCalls == 1 && results == 10, "single flight coalesces callers");
+    expect(!flights.inFlight(1), "flight lands");
+
+    // The cache serves hits without the backend, evicts in LRU order and expires on TTL.
+    // Expiry timers keep service.run() going, so the backend here answers synchronously.
+    backendCalls = 0;
+    AsyncCache<int, std::string> cache(service, 2, 50);
+    std::string last;
+    auto get = [&](int key) {
+        cache.get(key, [&backendCalls, key]() {
+            ++backendCalls;
+            return "value" + std::to_string(key);
+        }).then([&last](const std::string &value) {
+            last = value;
+        });
+    };
+    get(1);
+    get(1);
+    expect(backendCalls == 1 && last == "value1", "hit is served from the cache");
+    get(2);
+    get(1);
+    get(3); // evicts 2, the least recently used
+    expect(backendCalls == 3 && cache.size() == 2, "cache is bounded");
+    get(1);
+    expect(backendCalls == 3, "recently used entry survives eviction");
+    get(2);
+    expect(backendCalls == 4, "evicted entry is fetched again");
+    service.run();
+    expect(cache.size() == 0, "entries expire after the ttl");
+
+    // Concurrent misses on a cold key share one backend call.
+    backendCalls = 0;
+    for (int i = 0; i < 5; ++i)
+        cache.get(7, backend(7));
+    service.run();
+    expect(backendCalls == 1, "concurrent misses are coalesced");
+
+    // A load that was in flight when its key was invalidated answers its callers but is not
+    // stored; a miss after the invalidation starts its own load instead of joining it.
+    int version = 0;
+    auto versioned = [&service, &version]() {
+        int loaded = ++version;
+        return service.delay(loaded == 1 ? 30 : 10).then([loaded]() {
+            return "v" + std::to_string(loaded);
+        });
+    };
+    std::string stale, fresh, cached;
+    cache.get(8, versioned).then([&stale](const std::string &value) {
+        stale = value;
+    });
+    cache.invalidate(8);
+    cache.get(8, versioned).then([&fresh](const std::string &value) {
+        fresh = value;
+    });
+    service.delay(40).then([&cache, &cached]() {
+        cache.get(8, []() {
+            return std::string("reloaded");
+        }).then([&cached](const std::string &value) {
+            cached = value;
+        });
+    });
+    service.run();
+    expect(stale == "v1" && fresh == "v2", "invalidate() does not join the load in flight");
+    expect(cached == "v2", "a load started before invalidate() is not stored");
+
+    bool failed = false;
+    cache.get(9, []() {
+        return newPromise([](Defer &defer) {
+            defer.reject(std::runtime_error("backend down"));
+        });
+    }).fail([&failed](const std::runtime_error &) {
+        failed = true;
+    });
+    service.run();
+    expect(failed && cache.size() == 0, "rejections are passed on and not cached");
+
+    return report();
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "extensions/task_scheduler/batcher.hpp"
+#include "test_util.hpp"
+using namespace promise;
+int main() {
+    Service service;
+    std::vector<std::vector<int>> batches;
+    Batcher<int, std::string> batcher(service, [&](const std::vector<int> &keys) {
+        batches.push_back(keys);
+        return service.delay(5).then([keys]() {
+            std::vector<std::string> values;
+            for (int key : keys)
+                values.push_back("v" + std::to_string(key));
+            return values;
+        });
+    }, 4);
+
+    // Six loads in one tick become a full batch of 4 and a batch of the remaining keys.
+    std::vector<std::string> results(6);
+    for (int i = 0; i < 6; ++i) {
+        batcher.load(i % 5).then([&results, i](const std::string &value) {
+            results[i] = value;
+        });
+    }
+    service.run();
+    expect(batches.size() == 2, "loads are grouped into batches");
+    expect(batches.size() == 2 && batches[0] == std::vector<int>({ 0, 1, 2, 3 }), "full batch dispatched at max size");
+    expect(batches.size() == 2 && batches[1] == std::vector<int>({ 4, 0 }), "rest dispatched on the next tick");
+    expect(results == std::vector<std::string>({ "v0", "v1", "v2", "v3", "v4", "v0" }), "results are split back to callers");
+
+    // Duplicate keys in one batch are sent once.
+    batches.clear();
+    std::vector<std::string> sevens;
+    for (int i = 0; i < 2; ++i) {
+        batcher.load(7).then([&sevens](const std::string &value) {
+            sevens.push_back(value);
+        });
+    }
+    service.run();
+    expect(batches.size() == 1 && batches[0] == std::vector<int>({ 7 }), "duplicate keys are sent once");
+    expect(sevens == std::vector<std::string>({ "v7", "v7" }), "every caller of a duplicate key gets the value");
+
+    // A failing batch rejects every caller in it.
+    Batcher<int, int> failing(service, [](const std::vector<int> &) {
+        return promise::reject(std::runtime_error("backend down"));
+    }, 10, 2);
+    int rejected = 0;
+    for (int i = 0; i < 3; ++i) {
+        failing.load(i).fail([&rejected](const std::runtime_error &) {
+            ++rejected;
+        });
+    }
+    service.run();
+    expect(rejected == 3, "batch rejection reaches every caller");
+
+    return report();
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "async-promise/promise.hpp"
+#include "async-promise/future.hpp"
+#include "async-promise/registry.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "test_util.hpp"
+using namespace promise;
+
+// Resolves on another thread after ms.
+static Promise resolveLater(int ms, int value) {
+    return newPromise([=](Defer &defer) {
+        std::thread([=]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+            defer.resolve(value);
+        }).detach();
+    });
+}
+
+int main() {
+    std::atomic<int> uncaught{0};
+    handleUncaughtException([&uncaught](Promise &promise) {
+        promise.fail([&uncaught]() {
+            ++uncaught;
+        });
+    });
+    expect(resolve(1).get<int>() == 1, "get() on a resolved promise");
+
+    Promise slow = resolveLater(20, 2);
+    expect(!slow.wait(std::chrono::milliseconds(1)), "wait() times out");
+    expect(slow.wait(std::chrono::milliseconds(5000)), "wait() returns once settled");
+    expect(slow.get<int>() == 2, "get() after wait()");
+
+    expect(resolveLater(5, 3).get<int>() == 3, "get() wakes on a cross-thread resolve");
+
+    std::string error;
+    try {
+        reject(std::runtime_error("boom")).get();
+    }
+    catch (const std::runtime_error &err) {
+        error = err.what();
+    }
+    expect(error == "boom", "get() throws the rejection");
+
+    int thrown = 0;
+    try {
+        reject(42).get();
+    }
+    catch (int value) {
+        thrown = value;
+    }
+    expect(thrown == 42, "non-exception rejections are thrown as their own type");
+    struct Untyped {
+        int value_;
+    };
+    int untyped = 0;
+    try {
+        reject(any(Untyped{ 9 })).get();
+    }
+    catch (const any &value) {
+        untyped = value.cast<Untyped>().value_;
+    }
+    expect(untyped == 9, "a rejection made from an any is thrown as the any");
+
+    // wait()/get() leave the chain as it was for handlers attached afterwards.
+    Promise waited = resolveLater(20, 7);
+    expect(!waited.wait(std::chrono::milliseconds(1)), "wait() times out before the value");
+    expect(waited.get<int>() == 7, "get() after a timed out wait()");
+    int chained = 0;
+    waited.then([&chained](int value) {
+        chained = value;
+    });
+    expect(chained == 7, "then() after get() sees the value");
+    Promise failedWait = reject(std::runtime_error("late"));
+    expect(failedWait.wait(), "wait() on a rejected promise");
+    std::string lateError;
+    bool resolvedAfterWait = false;
+    failedWait.then([&resolvedAfterWait]() {
+        resolvedAfterWait = true;
+    }).fail([&lateError](const std::runtime_error &err) {
+        lateError = err.what();
+    });
+    expect(!resolvedAfterWait && lateError == "late", "fail() after wait() sees the rejection");
+    // A rejection thrown by get() has been handled by its caller.
+    expect(uncaught == 0, "handled get() rejections are not reported as uncaught");
+    reject(std::runtime_error("dropped"));
+    expect(uncaught == 1, "a rejection nobody handles is still reported");
+
+    // Each wait()/get() sees the chain as it is at the time of the call.
+    Promise chain = resolve(1);
+    expect(chain.get<int>() == 1, "get() before then()");
+    chain.then([](int value) {
+        return value + 10;
+    });
+    expect(chain.get<int>() == 11, "get() after then() sees the new value");
+
+    // A rejection that arrives after a timed out wait() is not handled by anybody.
+    {
+        Promise rejectedLater = newPromise([](Defer &defer) {
+            std::thread([defer]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                defer.reject(std::runtime_error("late"));
+            }).detach();
+        });
+        expect(!rejectedLater.wait(std::chrono::milliseconds(1)), "wait() times out before the rejection");
+    }
+    for (int i = 0; i < 1000 && uncaught < 2; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    expect(uncaught == 2, "a rejection after a timed out wait() is reported as uncaught");
+
+    // Polling a pending promise with wait() leaves its chain as it was.
+    {
+        PromiseRegistry::enable(true);
+        Defer *saved = nullptr;
+        Promise polled = newPromise([&saved](Defer &defer) {
+            saved = new Defer(defer);
+        });
+        PromiseRegistry::enable(false);
+        auto pendingTasks = [&polled]() {
+            for (const PromiseInfo &info : PromiseRegistry::list()) {
+                if (info.promiseHolder_ == polled.sharedPromise_->promiseHolder_.load().get())
+                    return info.pendingTasks_;
+            }
+            return (size_t)-1;
+        };
+        size_t before = pendingTasks();
+        for (int i = 0; i < 100; ++i)
+            polled.wait(std::chrono::milliseconds(0));
+        expect(before != (size_t)-1 && pendingTasks() == before, "timed out wait()s do not grow the chain");
+        saved->resolve(9);
+        delete saved;
+        expect(polled.get<int>() == 9, "get() after polling with wait()");
+    }
+
+    std::future<int> future = toFuture<int>(resolveLater(5, 4));
+    expect(future.get() == 4, "toFuture() resolves");
+    std::future<void> failed = toFuture(reject(std::runtime_error("down")));
+    bool futureThrew = false;
+    try {
+        failed.get();
+    }
+    catch (const std::runtime_error &) {
+        futureThrew = true;
+    }
+    expect(futureThrew, "toFuture() carries the rejection");
+
+    int ready = 0;
+    std::promise<int> ready_source;
+    ready_source.set_value(5);
+    fromFuture(ready_source.get_future()).then([&ready](int value) {
+        ready = value;
+    });
+    expect(ready == 5, "fromFuture() of a ready future settles at once");
+    std::future<int> pending = std::async(std::launch::async, []() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return 6;
+    });
+    expect(fromFuture(std::move(pending)).get<int>() == 6, "fromFuture() of a pending future");
+    {
+        Service service;
+        std::promise<int> source;
+        int polledValue = 0;
+        fromFuture(service, source.get_future()).then([&polledValue](int value) {
+            polledValue = value;
+        });
+        std::thread producer([&source]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            source.set_value(8);
+        });
+        service.run();
+        producer.join();
+        expect(polledValue == 8, "fromFuture(service) polls a pending future on the service");
+    }
+
+    return report();
+}
@@ -0,0 +1,34 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "async-promise/promise.hpp"
+#include "test_util.hpp"
+using namespace promise;
+int main() {
+    // Another thread attaches a task while the chain is running, so the task is not at the front
+    // when then() calls it; the thread running the chain must still run it, after the others.
+    bool ordered = true;
+    for (int round = 0; round < 200; ++round) {
+        std::string order;
+        std::atomic<bool> running(false);
+        Promise promise = newPromise();
+        promise.then([&running]() {
+            running = true;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }).then([&order]() {
+            order += "a";
+        });
+        std::thread other([&running, &order, &promise]() {
+            while (!running) std::this_thread::yield();
+            promise.then([&order]() {
+                order += "b";
+            });
+        });
+        promise.resolve();
+        other.join();
+        if (order != "ab") ordered = false;
+    }
+    expect(ordered, "a task attached by another thread runs after the queued ones");
+    return report();
+}
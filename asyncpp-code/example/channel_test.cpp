@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "async-promise/channel.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "test_util.hpp"
+using namespace promise;
+// Producer pushes count values through the channel, each send() waits for space.
+static Promise produce(Channel<int> channel, int count) {
+    auto next = std::make_shared<int>(0);
+    return doWhile([channel, count, next](DeferLoop &loop) mutable {
+        if (*next == count) {
+            channel.close();
+            loop.doBreak();
+            return;
+        }
+        channel.send((*next)++).then(loop);
+    });
+}
+// Consumer takes values in batches of up to 3, yielding to the service between batches.
+static Promise consume(Service &service, Channel<int> channel, std::vector<int> &received, size_t &maxBuffered) {
+    return doWhile([&service, channel, &received, &maxBuffered](DeferLoop &loop) mutable {
+        maxBuffered = std::max(maxBuffered, channel.size());
+        channel.receiveMany(3).then([&service, &received](const std::vector<int> &values) {
+            received.insert(received.end(), values.begin(), values.end());
+            return service.yield();
+        }).then([loop]() {
+            loop.doContinue();
+        }, [loop]() {
+            loop.doBreak(); // closed and drained
+        });
+    });
+}
+int main() {
+    Service service;
+    Channel<int> channel(4);
+    std::vector<int> received;
+    size_t maxBuffered = 0;
+    produce(channel, 100);
+    consume(service, channel, received, maxBuffered);
+    service.run();
+    expect(received.size() == 100, "all values received");
+    bool ordered = true;
+    for (size_t i = 0; i < received.size(); ++i)
+        ordered = ordered && received[i] == (int)i;
+    expect(ordered, "values received in order");
+    expect(maxBuffered <= 4, "buffer stays within capacity");
+
+    Channel<std::string> unbuffered(0);
+    std::string got;
+    unbuffered.receive().then([&got](const std::string &value) {
+        got = value;
+    });
+    bool sent = false;
+    unbuffered.send("direct").then([&sent]() {
+        sent = true;
+    });
+    expect(got == "direct" && sent, "unbuffered send hands off to a waiting receiver");
+
+    bool rejected = false;
+    unbuffered.send("blocked").fail([&rejected](const std::runtime_error &) {
+        rejected = true;
+    });
+    unbuffered.close();
+    expect(rejected, "close() rejects blocked senders");
+
+    return report();
+}
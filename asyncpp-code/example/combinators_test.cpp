@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <list>
+#include <thread>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "extensions/task_scheduler/hedge.hpp"
+#include "extensions/task_scheduler/retry.hpp"
+#include "extensions/task_scheduler/deadline.hpp"
+#include "test_util.hpp"
+using namespace promise;
+
+static void testMapLimit(Service &service) {
+    // Synchronous work over a large range loops instead of recursing.
+    std::vector<int> items(100000);
+    for (size_t i = 0; i < items.size(); ++i)
+        items[i] = (int)i;
+    size_t count = 0;
+    long long sum = 0;
+    mapLimit(items, 8, [](int value) {
+        return value * 2;
+    }).then([&](const any &values) {
+        std::vector<any> &results = values.cast<std::vector<any> &>();
+        count = results.size();
+        for (const any &result : results)
+            sum += result.cast<int>();
+    });
+    expect(count == items.size() && sum == 9999900000LL, "mapLimit gathers results in order");
+
+    int inFlight = 0;
+    int maxInFlight = 0;
+    int finished = 0;
+    bool done = false;
+    forEachLimit(std::vector<int>{ 5, 1, 4, 2, 3, 1, 2, 5, 1, 1 }, 3, [&](int ms) {
+        maxInFlight = std::max(maxInFlight, ++inFlight);
+        return service.delay(ms).then([&]() {
+            --inFlight;
+            ++finished;
+        });
+    }).then([&done]() {
+        done = true;
+    });
+
+    int started = 0;
+    bool rejected = false;
+    mapLimit(std::vector<int>{ 1, 2, 3, 4 }, 1, [&](int value) -> Promise {
+        ++started;
+        if (value == 2)
+            return reject(std::runtime_error("failed"));
+        return service.delay(1);
+    }).fail([&rejected](const std::runtime_error &) {
+        rejected = true;
+    });
+
+    service.run();
+    expect(done && finished == 10, "forEachLimit runs every item");
+    expect(maxInFlight == 3, "forEachLimit caps calls in flight");
+    expect(rejected && started == 2, "mapLimit stops after the first failure");
+}
+
+static void testAsCompleted(Service &service) {
+    std::list<Promise> promises;
+    for (int ms : { 30, 10, 20 }) {
+        promises.push_back(service.delay(ms).then([ms]() {
+            return ms;
+        }));
+    }
+    promises.push_back(reject(std::runtime_error("failed")));
+    Channel<Completion> completed = asCompleted(promises);
+    std::vector<size_t> order;
+    size_t failures = 0;
+    bool closed = false;
+    doWhile([&](DeferLoop &loop) {
+        completed.receive().then([&, loop](const Completion &completion) {
+            order.push_back(completion.index_);
+            if (completion.state_ == TaskState::kRejected)
+                ++failures;
+            loop.doContinue();
+        }, [&closed, loop]() {
+            closed = true;
+            loop.doBreak();
+        });
+    });
+    service.run();
+    expect(order == std::vector<size_t>({ 3, 1, 2, 0 }), "asCompleted delivers in completion order");
+    expect(failures == 1, "asCompleted reports rejections");
+    expect(closed, "asCompleted closes after the last input");
+
+    // asCompleted() only observes its inputs.
+    int first = 0;
+    std::string error;
+    promises.front().then([&first](int value) {
+        first = value;
+    });
+    promises.back().fail([&error](const std::runtime_error &err) {
+        error = err.what();
+    });
+    expect(first == 30 && error == "failed", "inputs keep their outcome after asCompleted");
+
+    // Closing the channel early drops the later completions without uncaught rejections.
+    int uncaught = 0;
+    handleUncaughtException([&uncaught](Promise &promise) {
+        promise.fail([&uncaught]() {
+            ++uncaught;
+        });
+    });
+    {
+        Channel<Completion> abandoned = asCompleted(std::list<Promise>{ service.delay(5), service.delay(10) });
+        abandoned.close();
+    }
+    service.run();
+    handleUncaughtException(any());
+    expect(uncaught == 0, "asCompleted drops completions after the consumer closed");
+}
+
+static void testQuorum(Service &service) {
+    std::list<Promise> promises;
+    int cancelled = 0;
+    for (int ms : { 50, 5, 8, 100 }) {
+        promises.push_back(service.delay(ms).then([ms]() {
+            return ms;
+        }).fail([&cancelled](const std::runtime_error &) {
+            ++cancelled;
+        }));
+    }
+    std::vector<int> results;
+    quorum(2, promises).then([&results](const any &values) {
+        for (const any &value : values.cast<std::vector<any> &>())
+            results.push_back(value.cast<int>());
+    });
+    std::list<Promise> failing = { reject(1), reject(2), resolve(3) };
+    bool unreachable = false;
+    quorum(2, failing).fail([&unreachable](int) {
+        unreachable = true;
+    });
+    service.run();
+    expect(results == std::vector<int>({ 5, 8 }), "quorum resolves with the first k results");
+    expect(cancelled == 2, "quorum cancels the rest");
+    expect(unreachable, "quorum rejects once k successes are out of reach");
+
+    // quorum() only observes its inputs, also the rejected ones.
+    int second = 0;
+    std::next(promises.begin())->then([&second](int value) {
+        second = value;
+    });
+    int rejection = 0;
+    failing.front().fail([&rejection](int value) {
+        rejection = value;
+    });
+    expect(second == 5 && rejection == 1, "inputs keep their outcome after quorum");
+}
+
+static void testHedge(Service &service) {
+    // The first attempt stalls; the hedge started after 10ms answers first.
+    int attempts = 0;
+    int cancelled = 0;
+    int winner = 0;
+    hedge(service, [&]() {
+        int attempt = ++attempts;
+        return service.delay(attempt == 1 ? 200 : 5).then([attempt]() {
+            return attempt;
+        }, [&cancelled]() {
+            ++cancelled;
+            return reject(std::runtime_error("cancelled"));
+        });
+    }, 10, 3).then([&winner](int attempt) {
+        winner = attempt;
+    });
+
+    // A fast first attempt never triggers a hedge.
+    int fastAttempts = 0;
+    hedge(service, [&]() {
+        ++fastAttempts;
+        return service.delay(1);
+    }, 50, 3);
+
+    // A factory with no result resolves the hedge like a void then() callback.
+    bool voidDone = false;
+    hedge(service, []() {
+    }, 50, 2).then([&voidDone]() {
+        voidDone = true;
+    });
+
+    // When every attempt fails the last error is reported.
+    int failingAttempts = 0;
+    bool failed = false;
+    hedge(service, [&failingAttempts]() -> Promise {
+        ++failingAttempts;
+        return reject(std::runtime_error("down"));
+    }, 1000, 3).fail([&failed](const std::runtime_error &) {
+        failed = true;
+    });
+
+    // An early retry replaces the pending hedge timer instead of leaving a second one armed:
+    // attempts start at 0, 0 (retry) and 50ms, not a fourth one at 50ms as well.
+    int spacedAttempts = 0;
+    int attemptsAt75 = 0;
+    hedge(service, [&spacedAttempts]() -> Promise {
+        int attempt = ++spacedAttempts;
+        if (attempt == 1) return reject(std::runtime_error("refused"));
+        if (attempt == 4) return resolve(attempt);
+        return newPromise([](Defer &) {}); // stalls until cancelled
+    }, 50, 4);
+    service.setTimer(75, [&spacedAttempts, &attemptsAt75](bool) {
+        attemptsAt75 = spacedAttempts;
+    });
+
+    // Attempt 0 wins on another thread while attempt 1's factory is still running:
+    // the late attempt is cancelled instead of being stored into the decided hedge.
+    std::unique_ptr<Defer> firstAttempt;
+    int lateWinner = 0;
+    bool lateCancelled = false;
+    hedge(service, [&]() -> Promise {
+        if (!firstAttempt) {
+            return newPromise([&firstAttempt](Defer &defer) {
+                firstAttempt.reset(new Defer(defer));
+            });
+        }
+        std::thread([&firstAttempt]() {
+            firstAttempt->resolve(1);
+        }).join();
+        return newPromise([](Defer &) {}).fail([&lateCancelled](const std::runtime_error &) {
+            lateCancelled = true;
+        });
+    }, 5, 2).then([&lateWinner](int attempt) {
+        lateWinner = attempt;
+    });
+
+    // The losing attempt's continuation waits on a Service that never runs; it must not keep
+    // the decided hedge, and the factory it owns, alive.
+    Service idle;
+    auto factoryToken = std::make_shared<int>(0);
+    int pinnedAttempts = 0;
+    hedge(service, [&pinnedAttempts, &idle, factoryToken]() -> Promise {
+        if (++pinnedAttempts == 1)
+            return resolve(1).setExecutor(idle);
+        return resolve(2);
+    }, 5, 2);
+
+    auto start = std::chrono::steady_clock::now();
+    service.run();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    expect(pinnedAttempts == 2 && factoryToken.use_count() == 1, "a decided hedge is released while a loser is stuck");
+    expect(lateWinner == 1 && lateCancelled, "attempt started while another wins is cancelled");
+    expect(attemptsAt75 == 3 && spacedAttempts == 4, "early retry keeps the hedge spacing");
+    // The failing hedge above armed a 1000ms timer; it is removed once the hedge is decided.
+    expect(elapsed < std::chrono::milliseconds(900), "decided hedges leave no timers behind");
+    expect(winner == 2 && attempts == 2, "hedged attempt wins");
+    expect(cancelled == 1, "slow attempt is cancelled");
+    expect(fastAttempts == 1, "no hedge when the first attempt is fast");
+    expect(voidDone, "void factory resolves the hedge");
+    expect(failed && failingAttempts == 3, "failed attempts are hedged immediately");
+}
+
+static void testRetry(Service &service) {
+    // Fails twice, then succeeds; backoff is 10ms then 20ms without jitter.
+    RetryPolicy policy;
+    policy.initialDelayMs_ = 10;
+    policy.jitter_ = 0;
+    int calls = 0;
+    int value = 0;
+    auto start = std::chrono::steady_clock::now();
+    retry(service, [&calls]() -> Promise {
+        if (++calls < 3)
+            return reject(std::runtime_error("transient"));
+        return resolve(42);
+    }, policy).then([&value](int result) {
+        value = result;
+    });
+    service.run();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    expect(value == 42 && calls == 3, "retry succeeds after transient failures");
+    expect(elapsed.count() >= 30, "retry backs off exponentially");
+
+    // Errors the predicate does not accept are not retried.
+    policy.retryable_ = [](const std::runtime_error &err) {
+        return std::string(err.what()) != "fatal";
+    };
+    int fatalCalls = 0;
+    bool fatal = false;
+    retry(service, [&fatalCalls]() -> Promise {
+        ++fatalCalls;
+        return reject(std::runtime_error("fatal"));
+    }, policy).fail([&fatal](const std::runtime_error &) {
+        fatal = true;
+    });
+
+    // The deadline stops retrying before maxAttempts.
+    RetryPolicy deadline;
+    deadline.maxAttempts_ = 100;
+    deadline.initialDelayMs_ = 20;
+    deadline.multiplier_ = 1;
+    deadline.jitter_ = 0;
+    deadline.deadlineMs_ = 50;
+    int deadlineCalls = 0;
+    bool expired = false;
+    retry(service, [&deadlineCalls]() -> Promise {
+        ++deadlineCalls;
+        return reject(std::runtime_error("transient"));
+    }, deadline).fail([&expired](const std::runtime_error &) {
+        expired = true;
+    });
+
+    // An attempt that never settles is cut off when the budget runs out.
+    RetryPolicy hung;
+    hung.deadlineMs_ = 30;
+    bool hungTimedOut = false;
+    bool hungCancelled = false;
+    start = std::chrono::steady_clock::now();
+    retry(service, [&hungCancelled]() {
+        return newPromise([](Defer &) {}).fail([&hungCancelled](const TimeoutError &) {
+            hungCancelled = true;
+            return reject(TimeoutError("cancelled"));
+        });
+    }, hung).fail([&hungTimedOut](const TimeoutError &) {
+        hungTimedOut = true;
+    });
+    service.run();
+    elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    expect(fatal && fatalCalls == 1, "non-retryable errors fail at once");
+    expect(expired && deadlineCalls == 3, "retry respects the deadline");
+    expect(hungTimedOut && hungCancelled && elapsed.count() < 400, "a hung attempt is cut off at the deadline");
+}
+
+static void testDeadline(Service &service) {
+    // An operation that never finishes is cut off with a TimeoutError and cancelled.
+    // (Plain delay() timers stay in the store until they expire, so they are not used here.)
+    bool timedOut = false;
+    bool cancelled = false;
+    auto start = std::chrono::steady_clock::now();
+    withDeadline(service, newPromise([](Defer &) {}).fail([&cancelled](const TimeoutError &) {
+        cancelled = true;
+        return reject(std::runtime_error("cancelled"));
+    }), 10).fail([&timedOut](const TimeoutError &) {
+        timedOut = true;
+    });
+
+    // A fast one settles normally, and its timer leaves the store at once.
+    int value = 0;
+    Promise fast = service.delay(1).then([]() {
+        return 7;
+    });
+    withDeadline(service, fast, 500).then([&value](int result) {
+        value = result;
+    });
+    Promise early = reject(std::runtime_error("early"));
+    std::string earlyError;
+    withDeadline(service, early, 500).fail([&earlyError](const std::runtime_error &err) {
+        earlyError = err.what();
+    });
+
+    service.run();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    expect(timedOut && cancelled, "deadline rejects with TimeoutError and cancels the operation");
+    expect(value == 7, "result passes through before the deadline");
+    expect(earlyError == "early", "rejection passes through before the deadline");
+    // withDeadline() only observes the operation: it keeps its outcome for other holders.
+    int later = 0;
+    fast.then([&later](int result) {
+        later = result;
+    });
+    std::string laterError;
+    early.fail([&laterError](const std::runtime_error &err) {
+        laterError = err.what();
+    });
+    expect(later == 7 && laterError == "early", "operation keeps its outcome after withDeadline");
+    expect(elapsed.count() < 400, "settled deadlines are disarmed");
+
+    // Nested operations inherit the deadline of the chain they are started from.
+    bool innerTimedOut = false;
+    int retryCalls = 0;
+    RetryPolicy policy;
+    policy.maxAttempts_ = 100;
+    policy.initialDelayMs_ = 10;
+    policy.multiplier_ = 1;
+    policy.jitter_ = 0;
+    start = std::chrono::steady_clock::now();
+    auto innerDeadline = std::chrono::steady_clock::time_point::max();
+    withDeadline(service, service.delay(1).then([&]() {
+        innerDeadline = currentDeadline();
+        return withDeadline(service, newPromise([](Defer &) {}), 1000);
+    }), 30).fail([&innerTimedOut](const TimeoutError &) {
+        innerTimedOut = true;
+    });
+    withDeadline(service, service.delay(1).then([&]() {
+        return retry(service, [&retryCalls]() -> Promise {
+            ++retryCalls;
+            return reject(std::runtime_error("transient"));
+        }, policy);
+    }), 35).fail([](const std::runtime_error &) {
+    });
+    // Steps chained after a settled withDeadline() are not bound by its deadline.
+    auto afterDeadline = std::chrono::steady_clock::time_point::min();
+    withDeadline(service, resolve(), 10).then([&afterDeadline]() {
+        afterDeadline = currentDeadline();
+    });
+    // Another consumer of the guarded promise is not bound by it either.
+    auto guardedDeadline = std::chrono::steady_clock::time_point::max();
+    auto otherDeadline = std::chrono::steady_clock::time_point::min();
+    Promise shared = service.delay(1).then([&guardedDeadline]() {
+        guardedDeadline = currentDeadline();
+    });
+    withDeadline(service, shared, 500);
+    shared.then([&otherDeadline]() {
+        otherDeadline = currentDeadline();
+    });
+    service.run();
+    elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    expect(innerTimedOut && elapsed.count() < 400, "nested deadline is capped by the outer one");
+    expect(innerDeadline < start + std::chrono::milliseconds(100), "work inside the guarded operation inherits its deadline");
+    expect(retryCalls >= 2 && retryCalls <= 4, "retry stops at the inherited deadline");
+    expect(afterDeadline == std::chrono::steady_clock::time_point::max(), "steps after withDeadline() do not inherit its deadline");
+    expect(guardedDeadline != std::chrono::steady_clock::time_point::max()
+        && otherDeadline == std::chrono::steady_clock::time_point::max(), "a second consumer of the guarded promise is not bound by its deadline");
+}
+
+// The combinators cancel losing attempts with Promise::reject(), which may race the attempt
+// being resolved on another thread: exactly one of the two settles it.
+static void testCancelWhileResolving() {
+    const int rounds = 2000;
+    std::atomic<int> resolved{0};
+    std::atomic<int> cancelled{0};
+    for (int i = 0; i < rounds; ++i) {
+        std::unique_ptr<Defer> attempt;
+        Promise promise = newPromise([&attempt](Defer &defer) {
+            attempt.reset(new Defer(defer));
+        });
+        promise.then([&resolved](int) {
+            ++resolved;
+        }, [&cancelled](const std::runtime_error &) {
+            ++cancelled;
+        });
+        // Relaxed, so the two threads are not ordered by anything but the promise's own locking.
+        std::atomic<bool> resolving{false};
+        std::thread resolver([&]() {
+            resolving.store(true, std::memory_order_relaxed);
+            attempt->resolve(1);
+        });
+        while (!resolving.load(std::memory_order_relaxed))
+            std::this_thread::yield();
+        promise.reject(std::runtime_error("cancel"));
+        resolver.join();
+    }
+    expect(resolved + cancelled == rounds, "a cancelled attempt settles exactly once");
+}
+
+int main() {
+    Service service;
+    testMapLimit(service);
+    testAsCompleted(service);
+    testQuorum(service);
+    testHedge(service);
+    testRetry(service);
+    testDeadline(service);
+    testCancelWhileResolving();
+    return report();
+}
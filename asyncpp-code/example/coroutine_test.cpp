@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include "async-promise/promise.hpp"
+#include "async-promise/coroutine.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "test_util.hpp"
+using namespace promise;
+
+static CoPromise addLater(Service &service, int a, int b) {
+    co_await service.delay(1);
+    int first = (co_await resolve(a)).cast<int>();
+    co_return first + b;
+}
+static CoPromise failing() {
+    co_await resolve();
+    throw std::runtime_error("coroutine failed");
+}
+static CoPromise catching(std::string &error) {
+    try {
+        co_await reject(std::runtime_error("awaited rejection"));
+    }
+    catch (const std::runtime_error &err) {
+        error = err.what();
+    }
+    co_return {};
+}
+
+static CoPromise awaitShared(Promise shared, int &seen) {
+    try {
+        seen = (co_await shared).cast<int>();
+    }
+    catch (const std::runtime_error &) {
+        seen = -1;
+    }
+    co_return {};
+}
+
+// Another thread attaches to the awaited promise while the resumed coroutine still runs.
+static CoPromise attachFromThread(Promise awaited, bool &attached) {
+    co_await awaited;
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    std::thread([awaited, done]() mutable {
+        awaited.then([]() {
+        });
+        *done = true;
+    }).detach();
+    for (int i = 0; i < 1000 && !*done; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    attached = *done;
+    co_return {};
+}
+
+static AsyncGenerator<int> counter(int count) {
+    for (int i = 0; i < count; ++i)
+        co_yield i;
+}
+// A cursor-based backend: every page arrives later, from the Service.
+struct Backend {
+    Service &service_;
+    int      pages_;
+    Promise fetchPage(int cursor) {
+        int pages = pages_;
+        return service_.delay(1).then([cursor, pages]() {
+            std::vector<int> page;
+            if (cursor < pages) {
+                for (int i = 0; i < 3; ++i)
+                    page.push_back(cursor * 3 + i);
+            }
+            return page;
+        });
+    }
+};
+static AsyncGenerator<int> rows(Backend &backend, int &produced) {
+    for (int cursor = 0;; ++cursor) {
+        std::vector<int> page = (co_await backend.fetchPage(cursor)).cast<std::vector<int>>();
+        if (page.empty()) co_return;
+        for (int row : page) {
+            ++produced;
+            co_yield row;
+        }
+    }
+}
+static AsyncGenerator<int> broken() {
+    co_yield 1;
+    throw std::runtime_error("producer failed");
+}
+
+static CoPromise sumAll(AsyncGenerator<int> generator) {
+    long long sum = 0;
+    while (std::optional<int> value = co_await generator.next())
+        sum += *value;
+    co_return sum;
+}
+static CoPromise consumeRows(Backend &backend, int &produced, bool &inStep) {
+    AsyncGenerator<int> generator = rows(backend, produced);
+    int consumed = 0;
+    while (std::optional<int> row = co_await generator.next()) {
+        // The producer is never more than the current element ahead.
+        inStep = inStep && (produced == consumed + 1) && (*row == consumed);
+        ++consumed;
+    }
+    co_return consumed;
+}
+static CoPromise consumeBroken(std::vector<int> &values) {
+    AsyncGenerator<int> generator = broken();
+    while (std::optional<int> value = co_await generator.next())
+        values.push_back(*value);
+    co_return {};
+}
+
+int main() {
+    int uncaught = 0;
+    handleUncaughtException([&uncaught](Promise &promise) {
+        promise.fail([&uncaught]() {
+            ++uncaught;
+        });
+    });
+    {
+        Service service;
+        int sum = 0;
+        addLater(service, 2, 3).then([&sum](int value) {
+            sum = value;
+        });
+        expect(sum == 0, "coroutine suspends on a pending promise");
+        service.run();
+        expect(sum == 5, "co_return resolves the coroutine's promise");
+
+        std::string error;
+        failing().fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        expect(error == "coroutine failed", "an escaping exception rejects the promise");
+        catching(error);
+        expect(error == "awaited rejection", "co_await throws the rejection reason");
+        expect(uncaught == 0, "a rejection caught in the coroutine is not reported as uncaught");
+
+        // co_await leaves the promise as it was for its other holders.
+        Promise shared = resolve(9);
+        int seen = 0;
+        awaitShared(shared, seen);
+        int later = 0;
+        shared.then([&later](int value) {
+            later = value;
+        });
+        expect(seen == 9 && later == 9, "awaited value is still there for later handlers");
+        Promise failedShared = reject(std::runtime_error("shared failure"));
+        awaitShared(failedShared, seen);
+        std::string laterError;
+        failedShared.then([&laterError]() {
+            laterError = "resolved";
+        }).fail([&laterError](const std::runtime_error &err) {
+            laterError = err.what();
+        });
+        expect(seen == -1 && laterError == "shared failure", "awaited rejection is still there for later handlers");
+        expect(uncaught == 0, "awaited rejections stay unreported");
+    }
+    {
+        Defer *saved = nullptr;
+        Promise awaited = newPromise([&saved](Defer &defer) {
+            saved = new Defer(defer);
+        });
+        bool attached = false;
+        attachFromThread(awaited, attached);
+        saved->resolve();
+        delete saved;
+        expect(attached, "the coroutine resumes after the awaited promise is released");
+    }
+    {
+        long long sum = 0;
+        sumAll(counter(10000)).then([&sum](long long value) {
+            sum = value;
+        });
+        expect(sum == 10000LL * 9999 / 2, "generator with a synchronous producer");
+    }
+    {
+        Service service;
+        Backend backend{ service, 4 };
+        int produced = 0;
+        bool inStep = true;
+        int consumed = 0;
+        consumeRows(backend, produced, inStep).then([&consumed](int value) {
+            consumed = value;
+        });
+        service.run();
+        expect(consumed == 12 && produced == 12, "paging generator yields every row");
+        expect(inStep, "producer and consumer alternate");
+
+        std::vector<int> values;
+        std::string error;
+        consumeBroken(values).fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        expect(values == std::vector<int>({ 1 }) && error == "producer failed", "producer exceptions surface in next()");
+    }
+    return report();
+}
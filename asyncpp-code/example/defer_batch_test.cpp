@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "test_util.hpp"
+using namespace promise;
+
+// A pending promise whose handlers append "<name>=<value>" or "<name>!<reason>" to log.
+static Defer watch(std::vector<std::string> &log, const std::string &name) {
+    std::vector<Defer> defers;
+    newPromise([&defers](Defer &defer) {
+        defers.push_back(defer);
+    }).then([&log, name](int value) {
+        log.push_back(name + "=" + std::to_string(value));
+    }, [&log, name](const std::runtime_error &err) {
+        log.push_back(name + "!" + err.what());
+    });
+    return defers.front();
+}
+
+int main() {
+    {
+        // Different holders, the same Defer twice, and one Defer settled beforehand.
+        std::vector<std::string> log;
+        Defer a = watch(log, "a");
+        Defer b = watch(log, "b");
+        Defer settled = watch(log, "c");
+        settled.resolve(1);
+        std::vector<Defer> defers{ a, settled, b, a };
+        resolveAll(defers, 7);
+        expect(log == std::vector<std::string>({ "c=1", "a=7", "b=7" }), "resolveAll settles each pending Defer once, in order");
+
+        log.clear();
+        Defer d = watch(log, "d");
+        Defer e = watch(log, "e");
+        e.reject(std::runtime_error("first"));
+        std::vector<Defer> failed{ d, e, a };
+        rejectAll(failed, std::runtime_error("down"));
+        expect(log == std::vector<std::string>({ "e!first", "d!down" }), "rejectAll skips settled Defers");
+    }
+    {
+        // DeferBatch collects Defers and settles them in the order they were added.
+        std::vector<std::string> log;
+        DeferBatch batch;
+        batch.add(watch(log, "x"));
+        batch.add(watch(log, "y"));
+        expect(batch.size() == 2, "batch collects Defers");
+        batch.resolve(3);
+        expect(batch.empty(), "resolve() empties the batch");
+        expect(log == std::vector<std::string>({ "x=3", "y=3" }), "batch resolves in insertion order");
+
+        Defer z = watch(log, "z");
+        batch.add(z);
+        batch.add(z);
+        batch.reject(std::runtime_error("gone"));
+        batch.resolve(4); // empty now, does nothing
+        expect(log.back() == "z!gone" && log.size() == 3, "batch reject, duplicates settle once");
+
+        // Each Defer runs its continuations before the next one is settled, so a continuation
+        // can still settle a later Defer of the batch itself.
+        log.clear();
+        std::vector<Defer> defers;
+        newPromise([&defers](Defer &defer) {
+            defers.push_back(defer);
+        }).then([&log, &defers](int value) {
+            log.push_back("first=" + std::to_string(value));
+            defers[1].resolve(99);
+        });
+        defers.push_back(watch(log, "second"));
+        batch.add(defers[0]);
+        batch.add(defers[1]);
+        batch.resolve(5);
+        expect(log == std::vector<std::string>({ "first=5", "second=99" }), "batch settles the Defers one after another");
+    }
+    return report();
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "extensions/task_scheduler/thread_pool.hpp"
+#include "test_util.hpp"
+using namespace promise;
+// Holds posted tasks until drain(), so settles can race with delivery. drain() is its run loop.
+struct QueueExecutor {
+    std::vector<std::function<void()>> tasks_;
+    size_t                             posted_ = 0;
+    void execute(std::function<void()> task) {
+        ++posted_;
+        tasks_.push_back(std::move(task));
+    }
+    void drain() {
+        ExecutorScope scope(*this);
+        while (!tasks_.empty()) {
+            std::vector<std::function<void()>> tasks;
+            tasks.swap(tasks_);
+            for (const std::function<void()> &task : tasks)
+                task();
+        }
+    }
+};
+
+int main() {
+    const std::thread::id mainThread = std::this_thread::get_id();
+    {
+        // InlineExecutor keeps everything on the calling thread.
+        InlineExecutor inlineExecutor;
+        int value = 0;
+        resolve(1).then_on(inlineExecutor, [&value](int result) {
+            value = result;
+        });
+        expect(value == 1, "inline executor runs at once");
+    }
+    {
+        // then_on() hops to the pool, and back to the service for the next stage.
+        ThreadPool pool(2);
+        Service service;
+        service.setAutoStop(false);
+        std::atomic<bool> onPool{ false };
+        bool backOnService = false;
+        std::string error;
+        resolve(2).then_on(pool, [&onPool, mainThread](int value) {
+            onPool = (std::this_thread::get_id() != mainThread);
+            return value * 2;
+        }).then_on(service, [&backOnService, mainThread](int value) {
+            backOnService = (value == 4 && std::this_thread::get_id() == mainThread);
+            throw std::runtime_error("boom");
+        }).then_on(service, nullptr, [&](const std::runtime_error &err) {
+            error = err.what();
+            service.stop();
+        });
+        service.run();
+        expect(onPool, "then_on(pool) runs on a worker");
+        expect(backOnService, "then_on(service) runs on the service thread");
+        expect(error == "boom", "rejections hop to the executor too");
+    }
+    {
+        // Promises with a default executor deliver cross-thread results to its thread.
+        Service service;
+        service.setAutoStop(false);
+        std::vector<Defer> defers;
+        int delivered = 0;
+        bool allOnService = true;
+        for (int i = 0; i < 8; ++i) {
+            newPromise([&defers](Defer &defer) {
+                defers.push_back(defer);
+            }).setExecutor(service).then([&, mainThread](int value) {
+                allOnService = allOnService && (std::this_thread::get_id() == mainThread);
+                delivered += value;
+                if (delivered == 8) service.stop();
+            });
+        }
+        std::thread worker([&defers]() {
+            for (const Defer &defer : defers)
+                defer.resolve(1);
+        });
+        worker.join();
+        expect(delivered == 0, "nothing runs on the resolving thread");
+        service.run();
+        expect(delivered == 8 && allOnService, "results are delivered on the owning loop");
+
+        // Attaching to an already settled promise from elsewhere also goes through the executor.
+        service.setAutoStop(true);
+        Promise settled = resolve(5).setExecutor(service);
+        int late = 0;
+        settled.then([&late](int value) {
+            late = value;
+        });
+        expect(late == 0, "late continuation is posted");
+        service.run();
+        expect(late == 5, "late continuation runs on the service");
+    }
+    {
+        // The first settle wins even while its delivery is still queued on the executor.
+        QueueExecutor queue;
+        std::optional<Defer> pending;
+        int resolved = 0;
+        int rejected = 0;
+        newPromise([&pending](Defer &defer) {
+            pending.emplace(defer);
+        }).setExecutor(queue).then([&resolved](int value) {
+            resolved = value;
+        }, [&rejected](int reason) {
+            rejected = reason;
+        });
+        pending->resolve(1);
+        pending->resolve(2);
+        pending->reject(3);
+        DeferBatch batch;
+        batch.add(*pending);
+        batch.reject(4);
+        queue.drain();
+        expect(resolved == 1 && rejected == 0, "later settles are ignored while delivery is queued");
+    }
+    {
+        // A promise bound to the executor that settles inside its run loop delivers inline:
+        // each stage below costs no extra hop through the queue.
+        QueueExecutor queue;
+        std::optional<Defer> pending;
+        std::vector<int> stages;
+        newPromise([&pending](Defer &defer) {
+            pending.emplace(defer);
+        }).setExecutor(queue).then([&stages, &queue](int value) -> Promise {
+            stages.push_back(value);
+            return newPromise([&queue](Defer &defer) {
+                queue.execute([defer]() {
+                    defer.resolve(2);
+                });
+            }).setExecutor(queue);
+        }).then([&stages](int value) {
+            stages.push_back(value);
+        });
+        queue.execute([&pending]() {
+            pending->resolve(1);
+        });
+        queue.drain();
+        expect(stages == std::vector<int>({ 1, 2 }), "stages run in order");
+        expect(queue.posted_ == 2, "settling on the executor's own loop does not post again");
+    }
+    {
+        // At stop, timer functions are called without the Service lock, so another thread
+        // they wait for can still use the Service.
+        Service service;
+        bool cancelled = false;
+        bool rescheduledCancelled = false;
+        service.setTimer(60000, [&service, &cancelled, &rescheduledCancelled](bool fired) {
+            cancelled = !fired;
+            std::thread([&service, &rescheduledCancelled]() {
+                service.setTimer(60000, [&rescheduledCancelled](bool fired) {
+                    rescheduledCancelled = !fired;
+                });
+            }).join();
+        });
+        service.stop();
+        service.run();
+        expect(cancelled && rescheduledCancelled, "stop cancels timers outside the service lock");
+    }
+    {
+        // Posted tasks still run at stop, also without the Service lock.
+        Service service;
+        int ran = 0;
+        service.execute([&service, &ran]() {
+            ++ran;
+            std::thread([&service, &ran]() {
+                service.execute([&ran]() {
+                    ++ran;
+                });
+            }).join();
+        });
+        service.stop();
+        service.run();
+        expect(ran == 2, "stop runs posted tasks outside the service lock");
+    }
+    return report();
+}
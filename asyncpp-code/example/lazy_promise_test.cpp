@@ -0,0 +1,103 @@
+#include "async-promise/promise.hpp"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_util.hpp"
+using namespace promise;
+int main() {
+    int runs = 0;
+    {
+        Promise dropped = lazyPromise([&runs](Defer &defer) {
+            ++runs;
+            defer.resolve(1);
+        });
+    }
+    expect(runs == 0, "dropped lazy promise must not run");
+
+    int value = 0;
+    Promise consumed = lazyPromise([&runs](Defer &defer) {
+        ++runs;
+        defer.resolve(2);
+    });
+    expect(runs == 0, "lazy promise must not run before then()");
+    consumed.then([&value](int v) {
+        value = v;
+    });
+    expect(runs == 1 && value == 2, "then() starts a lazy promise");
+    consumed.then([]() {});
+    expect(runs == 1, "lazy promise runs only once");
+
+    Promise settled = lazyPromise([&runs](Defer &defer) {
+        ++runs;
+        defer.resolve(3);
+    });
+    settled.resolve(4);
+    settled.then([&value](int v) {
+        value = v;
+    });
+    expect(runs == 1 && value == 4, "resolving from outside drops the lazy run");
+
+    Promise returned = lazyPromise([&runs](Defer &defer) {
+        ++runs;
+        defer.resolve(5);
+    });
+    newPromise([](Defer &defer) {
+        defer.resolve();
+    }).then([returned]() {
+        return returned;
+    }).then([&value](int v) {
+        value = v;
+    });
+    expect(runs == 2 && value == 5, "returning a lazy promise from a handler starts it");
+
+    Promise joined = lazyPromise([&runs](Defer &defer) {
+        ++runs;
+        defer.resolve(6);
+    });
+    all(joined).then([&value](const any &values) {
+        value = values.cast<std::vector<any> &>()[0].cast<int>();
+    });
+    expect(runs == 3 && value == 6, "combinators start lazy promises");
+
+    Promise throwing = lazyPromise([](Defer &) {
+        throw std::runtime_error("lazy");
+    });
+    std::string error;
+    throwing.fail([&error](const std::exception_ptr &ptr) {
+        try {
+            std::rethrow_exception(ptr);
+        }
+        catch (const std::runtime_error &err) {
+            error = err.what();
+        }
+    });
+    expect(error == "lazy", "exception in lazy run rejects the promise");
+
+    // Consumers racing on another thread: the first to use the promise runs it, once.
+    for (int round = 0; round < 200; ++round) {
+        std::atomic<int> raceRuns{ 0 };
+        std::atomic<int> seen{ 0 };
+        Promise raced = lazyPromise([&raceRuns](Defer &defer) {
+            ++raceRuns;
+            defer.resolve(7);
+        });
+        std::vector<std::thread> consumers;
+        for (int i = 0; i < 3; ++i) {
+            consumers.emplace_back([raced, &seen]() mutable {
+                raced.then([&seen](int v) {
+                    seen += v;
+                    return v;
+                });
+            });
+        }
+        for (std::thread &consumer : consumers)
+            consumer.join();
+        if (raceRuns != 1 || seen != 21) {
+            expect(false, "racing consumers run a lazy promise once");
+            break;
+        }
+    }
+
+    return report();
+}
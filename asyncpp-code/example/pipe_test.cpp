@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "test_util.hpp"
+using namespace promise;
+
+int main() {
+    {
+        // Stages run in order, each on the previous result; only the last one is boxed.
+        std::vector<std::string> order;
+        std::string result;
+        resolve(4).then(pipe([&order](int value) {
+            order.push_back("double");
+            return value * 2;
+        }, [&order](int value) {
+            order.push_back("add");
+            return value + 1;
+        }, [&order](int value) {
+            order.push_back("format");
+            return std::to_string(value);
+        })).then([&result](const std::string &value) {
+            result = value;
+        });
+        expect(result == "9", "each stage gets the previous stage's result");
+        expect(order == std::vector<std::string>({ "double", "add", "format" }), "stages run in order");
+
+        // The last stage may return a Promise, which joins the chain.
+        int joined = 0;
+        resolve(2).then(pipe([](int value) {
+            return value + 1;
+        }, [](int value) {
+            return resolve(value * 10);
+        })).then([&joined](int value) {
+            joined = value;
+        });
+        expect(joined == 30, "last stage returning a Promise");
+    }
+    {
+        // An exception in a stage skips the rest of the pipe and rejects the chain.
+        std::vector<std::string> order;
+        std::string error;
+        bool resolved = false;
+        resolve(1).then(pipe([&order](int value) {
+            order.push_back("first");
+            return value;
+        }, [&order](int value) -> int {
+            order.push_back("second");
+            throw std::runtime_error("stage " + std::to_string(value) + " failed");
+        }, [&order](int value) {
+            order.push_back("third");
+            return value;
+        })).then([&resolved]() {
+            resolved = true;
+        }).fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        expect(order == std::vector<std::string>({ "first", "second" }), "stages after a failure do not run");
+        expect(!resolved && error == "stage 1 failed", "stage failure rejects the chain");
+
+        // A rejection before the pipe passes over it.
+        bool ran = false;
+        error.clear();
+        reject(std::runtime_error("upstream")).then(pipe([&ran](int value) {
+            ran = true;
+            return value;
+        })).fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        expect(!ran && error == "upstream", "rejection skips the pipe");
+    }
+    {
+        // A pipe that takes and passes nothing: stages without arguments or results.
+        std::vector<std::string> order;
+        bool done = false;
+        resolve().then(pipe([&order]() {
+            order.push_back("a");
+        }, [&order]() {
+            order.push_back("b");
+        })).then([&done]() {
+            done = true;
+        });
+        expect(order == std::vector<std::string>({ "a", "b" }) && done, "empty pipe runs its stages and resolves");
+
+        // Called directly, a pipe is just the composed function.
+        auto composed = pipe([](int a, int b) {
+            return a * b;
+        }, [](int value) {
+            return value - 1;
+        });
+        expect(composed(3, 5) == 14, "pipe takes the first stage's arguments");
+    }
+    return report();
+}
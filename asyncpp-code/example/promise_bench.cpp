@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <functional>
+#include <stdexcept>
+#include "async-promise/promise.hpp"
+#ifndef PROMISE_VERSION
+#define PROMISE_VERSION "unknown"
+#endif
+using namespace promise;
+using steady_clock = std::chrono::steady_clock;
+
+struct Result {
+    std::string name;
+    size_t      iterations;
+    double      nsPerOp;
+    double      allocsPerOp;
+    double      bytesPerOp;
+};
+static std::vector<Result> s_results;
+static std::atomic<size_t> s_sink{0};
+template<typename T>
+static inline void keep(const T &value) {
+    s_sink.fetch_add((size_t)(uintptr_t)&value & 1, std::memory_order_relaxed);
+}
+
+// Runs func(n) for growing n until it takes at least 200ms (or n reaches maxN), records ns per op.
+static void bench(const std::string &name, const std::function<void(size_t n)> &func,
+                  size_t opsPerIteration = 1, size_t maxN = ((size_t)1 << 26)) {
+    size_t n = 16;
+    while (true) {
+#ifdef PM_DEBUG
+        AllocStats allocBefore = DebugAlloc::global();
+#endif
+        steady_clock::time_point start = steady_clock::now();
+        func(n);
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(steady_clock::now() - start).count();
+        if (ns >= 200000000 || n * 4 > maxN) {
+            const double ops = (double)(n * opsPerIteration);
+#ifdef PM_DEBUG
+            AllocStats allocUsed = DebugAlloc::global() - allocBefore;
+            s_results.push_back(Result{ name, n, (double)ns / ops, (double)allocUsed.allocations() / ops, (double)allocUsed.bytes() / ops });
+#else
+            s_results.push_back(Result{ name, n, (double)ns / ops, -1, -1 });
+#endif
+            fprintf(stderr, "%-32s %10zu %12.1f ns/op\n", name.c_str(), n, s_results.back().nsPerOp);
+            return;
+        }
+        n *= 4;
+    }
+}
+
+static void benchNewPromiseResolve() {
+    bench("new_promise_resolved", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            Promise promise = newPromise([](Defer &defer) {
+                defer.resolve(1);
+            });
+            keep(promise);
+        }
+    });
+    bench("new_promise_resolve_then", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            Defer *saved = nullptr;
+            Promise promise = newPromise([&saved](Defer &defer) {
+                saved = new Defer(defer);
+            });
+            promise.then([](int value) {
+                keep(value);
+            });
+            saved->resolve(1);
+            delete saved;
+        }
+    });
+}
+
+static void benchThenChainDepth() {
+    for (size_t depth : { 1, 4, 16, 64 }) {
+        bench("then_chain_depth_" + std::to_string(depth), [depth](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                Promise promise = newPromise();
+                for (size_t d = 0; d < depth; ++d) {
+                    promise.then([](int value) {
+                        return value + 1;
+                    });
+                }
+                promise.resolve(0);
+            }
+        }, depth);
+    }
+    bench("then_chain_fused_4", [](size_t n) {
+        auto step = [](int value) {
+            return value + 1;
+        };
+        for (size_t i = 0; i < n; ++i) {
+            Promise promise = newPromise();
+            promise.then(pipe(step, step, step, step));
+            promise.resolve(0);
+        }
+    }, 4);
+}
+
+static void benchAllWidth() {
+    for (size_t width : { 1, 16, 256, 4096 }) {
+        bench("all_width_" + std::to_string(width), [width](size_t n) {
+            for (size_t i = 0; i < n; i += width) {
+                std::vector<Defer> defers;
+                std::list<Promise> promises;
+                for (size_t w = 0; w < width; ++w) {
+                    promises.push_back(newPromise([&defers](Defer &defer) {
+                        defers.push_back(defer);
+                    }));
+                }
+                all(promises).then([](const std::vector<any> &results) {
+                    keep(results);
+                });
+                for (const Defer &defer : defers) {
+                    defer.resolve(1);
+                }
+            }
+        });
+    }
+}
+
+static void benchCrossThreadResolve() {
+    bench("cross_thread_resolve", [](size_t n) {
+        std::atomic<Defer *> slot{nullptr};
+        std::atomic<bool> stop{false};
+        std::thread worker([&]() {
+            while (!stop.load(std::memory_order_acquire)) {
+                Defer *defer = slot.exchange(nullptr, std::memory_order_acq_rel);
+                if (defer != nullptr) {
+                    defer->resolve(1);
+                    delete defer;
+                }
+                else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        for (size_t i = 0; i < n; ++i) {
+            std::atomic<bool> done{false};
+            newPromise([&slot](Defer &defer) {
+                slot.store(new Defer(defer), std::memory_order_release);
+            }).then([&done](int value) {
+                keep(value);
+                done.store(true, std::memory_order_release);
+            });
+            while (!done.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+        stop = true;
+        worker.join();
+    });
+}
+
+// Blocking get() on a promise settled by another thread; compare with
+// baseline_std_future_cross_thread (mutex + condition_variable).
+static void benchWait() {
+    bench("wait_resolved", [](size_t n) {
+        for (size_t i = 0; i < n; ++i)
+            keep(resolve(1).get<int>());
+    });
+    bench("wait_cross_thread", [](size_t n) {
+        std::atomic<Defer *> slot{nullptr};
+        std::atomic<bool> stop{false};
+        std::thread worker([&]() {
+            while (!stop.load(std::memory_order_acquire)) {
+                Defer *defer = slot.exchange(nullptr, std::memory_order_acq_rel);
+                if (defer != nullptr) {
+                    defer->resolve(1);
+                    delete defer;
+                }
+                else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        for (size_t i = 0; i < n; ++i) {
+            keep(newPromise([&slot](Defer &defer) {
+                slot.store(new Defer(defer), std::memory_order_release);
+            }).get<int>());
+        }
+        stop = true;
+        worker.join();
+    });
+}
+
+// doWhile() recurses while iterations complete synchronously, so n is capped to bound stack depth.
+static void benchDoWhile() {
+    bench("do_while_iteration", [](size_t n) {
+        size_t count = 0;
+        doWhile([&count, n](DeferLoop &loop) {
+            if (++count >= n)
+                loop.doBreak();
+            else
+                loop.doContinue();
+        });
+    }, 1, 4096);
+}
+
+static void benchReject() {
+    bench("reject_value", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            newPromise([](Defer &defer) {
+                defer.reject(1);
+            }).fail([](int value) {
+                keep(value);
+            });
+        }
+    });
+    bench("reject_exception", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            newPromise([](Defer &defer) {
+                defer.resolve();
+            }).then([]() {
+                throw std::runtime_error("bench");
+            }).fail([](const std::runtime_error &err) {
+                keep(err);
+            });
+        }
+    });
+}
+
+static void benchAny() {
+    bench("any_box_int", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            any value((int)i);
+            keep(value);
+        }
+    });
+    bench("any_box_string", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            any value(std::string("a string that does not fit sso"));
+            keep(value);
+        }
+    });
+    bench("any_copy_args_vector", [](size_t n) {
+        any value(std::vector<any>{ 1, 2.0, std::string("three") });
+        for (size_t i = 0; i < n; ++i) {
+            any copy(value);
+            keep(copy);
+        }
+    });
+}
+
+static void benchBaselines() {
+    bench("baseline_std_future", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            std::promise<int> promise;
+            std::future<int> future = promise.get_future();
+            promise.set_value(1);
+            keep(future.get());
+        }
+    });
+    bench("baseline_std_future_cross_thread", [](size_t n) {
+        std::atomic<std::promise<int> *> slot{nullptr};
+        std::atomic<bool> stop{false};
+        std::thread worker([&]() {
+            while (!stop.load(std::memory_order_acquire)) {
+                std::promise<int> *promise = slot.exchange(nullptr, std::memory_order_acq_rel);
+                if (promise != nullptr)
+                    promise->set_value(1);
+                else
+                    std::this_thread::yield();
+            }
+        });
+        for (size_t i = 0; i < n; ++i) {
+            std::promise<int> promise;
+            std::future<int> future = promise.get_future();
+            slot.store(&promise, std::memory_order_release);
+            keep(future.get());
+        }
+        stop = true;
+        worker.join();
+    });
+    bench("baseline_raw_callback", [](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            std::function<void(int)> callback = [](int value) {
+                keep(value);
+            };
+            std::function<void()> run = [&callback]() {
+                callback(1);
+            };
+            run();
+        }
+    });
+}
+
+int main(int argc, char **argv) {
+    std::string filter = (argc > 1 ? argv[1] : "");
+    const std::vector<std::pair<std::string, void (*)()>> groups = {
+        { "new_promise", &benchNewPromiseResolve },
+        { "then_chain", &benchThenChainDepth },
+        { "all", &benchAllWidth },
+        { "cross_thread", &benchCrossThreadResolve },
+        { "wait", &benchWait },
+        { "do_while", &benchDoWhile },
+        { "reject", &benchReject },
+        { "any", &benchAny },
+        { "baseline", &benchBaselines },
+    };
+    for (const auto &group : groups) {
+        if (filter.empty() || group.first.find(filter) != std::string::npos)
+            group.second();
+    }
+
+    printf("{\n  \"library\": \"async-promise\",\n  \"version\": \"%s\",\n  \"results\": [\n", PROMISE_VERSION);
+    for (size_t i = 0; i < s_results.size(); ++i) {
+        const Result &result = s_results[i];
+        printf("    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.2f",
+            result.name.c_str(), result.iterations, result.nsPerOp);
+        if (result.allocsPerOp >= 0)
+            printf(", \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f", result.allocsPerOp, result.bytesPerOp);
+        printf("}%s\n", (i + 1 < s_results.size() ? "," : ""));
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
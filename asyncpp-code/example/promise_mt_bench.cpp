@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include "async-promise/promise.hpp"
+using namespace promise;
+using steady_clock = std::chrono::steady_clock;
+
+// Multi-threaded contention benchmark and stress harness.
+// usage: promise_mt_bench [max_threads] [ops_per_thread]
+// Prints one JSON object with throughput (ops/s) per scenario and thread count.
+
+struct Sample {
+    std::string scenario;
+    size_t      threads;
+    size_t      ops;
+    double      opsPerSec;
+};
+static std::vector<Sample> s_samples;
+
+// Starts all threads together and returns the wall time until the last one finishes.
+static double runThreads(size_t threads, const std::function<void(size_t index)> &body) {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i]() {
+            ++ready;
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            body(i);
+        });
+    }
+    while (ready.load() < threads)
+        std::this_thread::yield();
+    steady_clock::time_point start = steady_clock::now();
+    go = true;
+    for (std::thread &worker : workers)
+        worker.join();
+    return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+static void record(const std::string &scenario, size_t threads, size_t ops, double seconds) {
+    s_samples.push_back(Sample{ scenario, threads, ops, (double)ops / seconds });
+    fprintf(stderr, "%-20s threads=%-3zu ops=%-9zu %14.0f ops/s\n", scenario.c_str(), threads, ops, (double)ops / seconds);
+}
+
+static void check(bool ok, const char *scenario, size_t threads) {
+    if (!ok) {
+        fprintf(stderr, "FAIL %s with %zu threads\n", scenario, threads);
+        exit(1);
+    }
+}
+
+// Each thread resolves and chains its own promises: baseline without shared state.
+static void independentChains(size_t threads, size_t opsPerThread) {
+    std::atomic<size_t> done{0};
+    double seconds = runThreads(threads, [&](size_t) {
+        size_t local = 0;
+        for (size_t i = 0; i < opsPerThread; ++i) {
+            Defer *saved = nullptr;
+            Promise promise = newPromise([&saved](Defer &defer) {
+                saved = new Defer(defer);
+            });
+            promise.then([](int value) {
+                return value + 1;
+            }).then([&local](int value) {
+                local += (size_t)value;
+            });
+            saved->resolve(0);
+            delete saved;
+        }
+        done += local;
+    });
+    check(done == threads * opsPerThread, "independent_chains", threads);
+    record("independent_chains", threads, threads * opsPerThread, seconds);
+}
+
+// Many threads call then() on one pending promise, then it is resolved once.
+static void sharedThen(size_t threads, size_t opsPerThread) {
+    Defer *saved = nullptr;
+    Promise promise = newPromise([&saved](Defer &defer) {
+        saved = new Defer(defer);
+    });
+    size_t calls = 0;
+    double seconds = runThreads(threads, [&](size_t) {
+        Promise local = promise;
+        for (size_t i = 0; i < opsPerThread; ++i) {
+            local.then([&calls]() {
+                ++calls;
+            });
+        }
+    });
+    steady_clock::time_point start = steady_clock::now();
+    saved->resolve();
+    seconds += std::chrono::duration<double>(steady_clock::now() - start).count();
+    delete saved;
+    check(calls == threads * opsPerThread, "shared_then", threads);
+    record("shared_then", threads, threads * opsPerThread, seconds);
+}
+
+// Threads settle disjoint slices of the inputs of one all().
+static void allManyToOne(size_t threads, size_t opsPerThread) {
+    std::vector<Defer> defers;
+    std::list<Promise> promises;
+    for (size_t i = 0; i < threads * opsPerThread; ++i) {
+        promises.push_back(newPromise([&defers](Defer &defer) {
+            defers.push_back(defer);
+        }));
+    }
+    size_t results = 0;
+    all(promises).then([&results](const any &values) {
+        results = values.cast<std::vector<any> &>().size();
+    });
+    double seconds = runThreads(threads, [&](size_t index) {
+        for (size_t i = index * opsPerThread; i < (index + 1) * opsPerThread; ++i)
+            defers[i].resolve((int)i);
+    });
+    check(results == threads * opsPerThread, "all_many_to_one", threads);
+    record("all_many_to_one", threads, threads * opsPerThread, seconds);
+}
+
+// Half the threads build chains whose handler returns a pending promise (join),
+// the other half resolve those promises, so continuations migrate across threads.
+// Needs at least two threads.
+static void crossThreadJoin(size_t threads, size_t opsPerThread) {
+    size_t producers = threads / 2;
+    size_t consumers = threads - producers;
+    std::mutex mutex;
+    std::deque<Defer> queue;
+    std::atomic<size_t> done{0};
+    const size_t total = producers * opsPerThread;
+    double seconds = runThreads(producers + consumers, [&](size_t index) {
+        if (index < producers) {
+            for (size_t i = 0; i < opsPerThread; ++i) {
+                Promise inner = newPromise([&](Defer &defer) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push_back(defer);
+                });
+                newPromise([](Defer &defer) {
+                    defer.resolve();
+                }).then([inner]() {
+                    return inner;
+                }).then([&done]() {
+                    ++done;
+                });
+            }
+        }
+        else {
+            while (done.load() < total) {
+                std::deque<Defer> batch;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    batch.swap(queue);
+                }
+                for (const Defer &defer : batch)
+                    defer.resolve();
+                if (batch.empty())
+                    std::this_thread::yield();
+            }
+        }
+    });
+    check(done == total, "cross_thread_join", threads);
+    record("cross_thread_join", threads, total, seconds);
+}
+
+// One thread joins pending promises into others with then(Promise) while the other threads
+// call then() on them, so then() races join() moving the promise to another holder.
+// Needs at least two threads.
+static void thenVsJoin(size_t threads, size_t opsPerThread) {
+    std::vector<Promise> targets;
+    std::vector<Promise> joined;
+    for (size_t i = 0; i < opsPerThread; ++i) {
+        targets.push_back(newPromise());
+        joined.push_back(newPromise());
+    }
+    std::atomic<size_t> calls{0};
+    double seconds = runThreads(threads, [&](size_t index) {
+        for (size_t i = 0; i < opsPerThread; ++i) {
+            if (index == 0) {
+                targets[i].then(joined[i]);
+            }
+            else {
+                joined[i].then([&calls]() {
+                    ++calls;
+                });
+            }
+        }
+    });
+    for (Promise &target : targets)
+        target.resolve();
+    check(calls == (threads - 1) * opsPerThread, "then_vs_join", threads);
+    record("then_vs_join", threads, threads * opsPerThread, seconds);
+}
+
+int main(int argc, char **argv) {
+    size_t maxThreads = (argc > 1 ? (size_t)atoi(argv[1]) : (size_t)std::thread::hardware_concurrency());
+    size_t opsPerThread = (argc > 2 ? (size_t)atoi(argv[2]) : 20000);
+    if (maxThreads < 4) maxThreads = 4;
+
+    std::vector<size_t> threadCounts;
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+
+    for (size_t threads : threadCounts) independentChains(threads, opsPerThread);
+    for (size_t threads : threadCounts) sharedThen(threads, opsPerThread);
+    for (size_t threads : threadCounts) allManyToOne(threads, opsPerThread);
+    for (size_t threads : threadCounts) {
+        if (threads >= 2) crossThreadJoin(threads, opsPerThread);
+    }
+    for (size_t threads : threadCounts) {
+        if (threads >= 2) thenVsJoin(threads, opsPerThread);
+    }
+
+    printf("{\n  \"hardware_concurrency\": %u,\n  \"ops_per_thread\": %zu,\n  \"samples\": [\n",
+        std::thread::hardware_concurrency(), opsPerThread);
+    for (size_t i = 0; i < s_samples.size(); ++i) {
+        const Sample &sample = s_samples[i];
+        // speedup is relative to the smallest thread count measured for the scenario
+        double base = 0;
+        for (const Sample &other : s_samples) {
+            if (other.scenario == sample.scenario && base == 0)
+                base = other.opsPerSec;
+        }
+        printf("    {\"scenario\": \"%s\", \"threads\": %zu, \"ops\": %zu, \"ops_per_sec\": %.0f, \"speedup\": %.3f}%s\n",
+            sample.scenario.c_str(), sample.threads, sample.ops, sample.opsPerSec, sample.opsPerSec / base,
+            (i + 1 < s_samples.size() ? "," : ""));
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
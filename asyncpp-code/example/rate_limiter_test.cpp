@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <chrono>
+#include "async-promise/promise.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "extensions/task_scheduler/rate_limiter.hpp"
+#include "test_util.hpp"
+using namespace promise;
+int main() {
+    {
+        // At 10 permits/s the enqueue loop cannot refill a token, so exactly the burst is granted.
+        Service service;
+        size_t granted = 0;
+        RateLimiter limiter(service, 10.0, 100);
+        for (size_t i = 0; i < 150; ++i) {
+            limiter.acquire().then([&granted]() {
+                ++granted;
+            }, [](const any &) {
+                // rejected when the limiter is destroyed below
+            });
+        }
+        expect(granted == 100, "burst is granted immediately");
+        expect(limiter.waiting() == 50, "the rest waits");
+    }
+
+    {
+        // Waiters still queued when the service stops are rejected.
+        Service service;
+        RateLimiter limiter(service, 1.0, 1);
+        bool rejected = false;
+        limiter.acquire();
+        limiter.acquire().fail([&rejected](const std::runtime_error &) {
+            rejected = true;
+        });
+        service.stop();
+        service.run();
+        expect(rejected && limiter.waiting() == 0, "waiters are rejected when the service stops");
+    }
+
+    Service service;
+    // 100000 waiters at 500k permits/s with a burst of 1000: about 200ms, on one timer.
+    const size_t kWaiters = 100000;
+    RateLimiter limiter(service, 500000.0, 1000);
+    size_t granted = 0;
+    bool inOrder = true;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kWaiters; ++i) {
+        limiter.acquire().then([&granted, &inOrder, i]() {
+            inOrder = inOrder && (i == granted);
+            ++granted;
+        });
+    }
+    expect(limiter.waiting() == kWaiters - granted, "waiters not granted yet are queued");
+
+    // A weighted request queues behind the others instead of overtaking them.
+    size_t grantedBeforeHeavy = 0;
+    limiter.acquire(500).then([&]() {
+        grantedBeforeHeavy = granted;
+    });
+    bool oversized = false;
+    limiter.acquire(1001).fail([&oversized](const std::runtime_error &) {
+        oversized = true;
+    });
+    expect(oversized, "requests above the burst are rejected");
+
+    service.run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    expect(granted == kWaiters, "all waiters granted");
+    expect(inOrder, "waiters granted in FIFO order");
+    expect(grantedBeforeHeavy == kWaiters, "weighted request served in FIFO order");
+    expect(limiter.waiting() == 0, "no waiter left behind");
+    printf("%zu permits in %.3f s\n", granted, seconds);
+    return report();
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "async-promise/registry.hpp"
+#include "test_util.hpp"
+using namespace promise;
+static Promise pending(std::vector<Defer> &defers) {
+    return newPromise([&defers](Defer &defer) {
+        defers.push_back(defer);
+    });
+}
+static const PromiseInfo *find(const std::vector<PromiseInfo> &infos, const Promise &promise) {
+    for (const PromiseInfo &info : infos) {
+        if (info.promiseHolder_ == promise.sharedPromise_->promiseHolder_.load().get()) return &info;
+    }
+    return nullptr;
+}
+static bool contains(const std::vector<PromiseInfo> &infos, const Promise &promise) {
+    return find(infos, promise) != nullptr;
+}
+
+int main() {
+    using std::chrono::milliseconds;
+    {
+        // Only promises created while enabled are tracked.
+        std::vector<Defer> defers;
+        Promise untracked = pending(defers);
+        expect(PromiseRegistry::size() == 0, "disabled registry tracks nothing");
+
+        PromiseRegistry::enable(true);
+        Promise old = pending(defers);
+        old.then([]() {});
+        std::this_thread::sleep_for(milliseconds(30));
+        Promise young = pending(defers);
+        Promise settled = pending(defers);
+        defers.back().resolve();
+        expect(PromiseRegistry::size() == 3, "promises created while enabled are tracked");
+        expect(!contains(PromiseRegistry::list(), untracked), "promises from before enable() are not listed");
+
+        std::vector<PromiseInfo> stuck = PromiseRegistry::pendingLongerThan(milliseconds(20));
+        expect(stuck.size() == 1 && contains(stuck, old), "pendingLongerThan() finds only the old pending promise");
+        std::vector<PromiseInfo> all = PromiseRegistry::list();
+        const PromiseInfo *youngInfo = find(all, young);
+        expect(!stuck.empty() && youngInfo != nullptr && stuck[0].age_ >= milliseconds(20)
+               && stuck[0].state_ == TaskState::kPending && stuck[0].pendingTasks_ == youngInfo->pendingTasks_ + 1,
+               "entry reports age, state and waiting handlers");
+        expect(!stuck.empty() && std::string(stuck[0].location_.function_name()).find("pending") != std::string::npos,
+               "entry reports the creation site");
+        expect(contains(PromiseRegistry::pendingLongerThan(milliseconds(0)), young), "zero threshold lists every pending promise");
+
+        // Settling takes a promise off the pending list; it stays registered while alive.
+        expect(!contains(PromiseRegistry::pendingLongerThan(milliseconds(0)), settled), "settled promise is not pending");
+        expect(contains(PromiseRegistry::list(), settled), "settled promise is still listed while alive");
+        defers[1].resolve();
+        expect(PromiseRegistry::pendingLongerThan(milliseconds(20)).empty(), "settling removes it from the pending list");
+
+        // Destruction unregisters the holder.
+        defers.clear();
+        old = Promise();
+        young = Promise();
+        settled = Promise();
+        expect(PromiseRegistry::size() == 0 && PromiseRegistry::list().empty(), "destroyed promises are unregistered");
+        PromiseRegistry::enable(false);
+    }
+    return report();
+}
@@ -0,0 +1,92 @@
+#include "async-promise/promise.hpp"
+#include "async-promise/scope.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "test_util.hpp"
+using namespace promise;
+int main() {
+    {
+        // join() waits for every child, including ones spawned by children.
+        std::vector<Defer> defers;
+        Scope scope;
+        for (int i = 0; i < 3; ++i) {
+            scope.spawn(newPromise([&defers](Defer &defer) {
+                defers.push_back(defer);
+            }));
+        }
+        scope.spawn([&scope, &defers]() {
+            scope.spawn(newPromise([&defers](Defer &defer) {
+                defers.push_back(defer);
+            }));
+        });
+        expect(scope.outstanding() == 4, "outstanding counts running children");
+        bool joined = false;
+        scope.join().then([&joined]() {
+            joined = true;
+        });
+        defers[0].resolve();
+        defers[1].resolve();
+        defers[2].resolve();
+        expect(!joined && scope.outstanding() == 1, "join waits for the nested child");
+        defers[3].resolve();
+        expect(joined && scope.outstanding() == 0, "join resolves once all children finished");
+
+        bool late = false;
+        scope.spawn([&late]() {
+            late = true;
+        });
+        expect(scope.outstanding() == 0 && !late, "a drained scope does not run new children");
+    }
+    {
+        // The first failure cancels the other children and is reported by join().
+        std::vector<Defer> defers;
+        int cancelled = 0;
+        Scope scope;
+        for (int i = 0; i < 3; ++i) {
+            scope.spawn(newPromise([&defers](Defer &defer) {
+                defers.push_back(defer);
+            }).fail([&cancelled](const std::runtime_error &err) {
+                if (std::string(err.what()) == "cancelled by scope") ++cancelled;
+                throw err;
+            }));
+        }
+        std::string error;
+        scope.join().fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        defers[1].reject(std::runtime_error("boom"));
+        expect(error == "boom", "join rejects with the first failure");
+        expect(cancelled == 2 && scope.outstanding() == 0, "failure cancels the rest");
+        expect(scope.isCancelled(), "failed scope reports cancelled");
+    }
+    {
+        // A cancelled scope does not run the function of a child spawned afterwards.
+        Scope scope;
+        scope.cancel(std::runtime_error("stop"));
+        bool late = false;
+        scope.spawn([&late]() {
+            late = true;
+        });
+        expect(!late && scope.isClosed() && scope.outstanding() == 0, "a cancelled scope does not run new children");
+    }
+    {
+        // Destroying a scope releases what its children captured.
+        auto resource = std::make_shared<int>(1);
+        std::weak_ptr<int> weak = resource;
+        std::vector<Defer> defers;
+        {
+            Scope scope;
+            scope.spawn(newPromise([&defers](Defer &defer) {
+                defers.push_back(defer);
+            }).then([resource]() {
+                return *resource;
+            }));
+            resource.reset();
+            expect(!weak.expired(), "running child keeps its state");
+        }
+        defers.clear();
+        expect(weak.expired(), "scope teardown releases child state");
+    }
+    return report();
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <stdexec/execution.hpp>
+#include "async-promise/promise.hpp"
+#include "async-promise/sender.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "test_util.hpp"
+using namespace promise;
+// Built with PROMISE_WITH_STDEXEC=ON.
+int main() {
+    // A promise feeds stdexec algorithms.
+    auto [sum] = stdexec::sync_wait(as_sender<int>(resolve(20)) | stdexec::then([](int value) {
+        return value + 1;
+    })).value();
+    expect(sum == 21, "as_sender resolves into then()");
+
+    std::string error;
+    try {
+        stdexec::sync_wait(as_sender<int>(reject(std::runtime_error("failed"))));
+    }
+    catch (const std::runtime_error &err) {
+        error = err.what();
+    }
+    expect(error == "failed", "as_sender rejects through set_error");
+
+    // when_all() over a promise settled on another thread and one settled already.
+    Defer *saved = nullptr;
+    Promise later = newPromise([&saved](Defer &defer) {
+        saved = new Defer(defer);
+    });
+    std::thread resolver([saved]() {
+        saved->resolve(2);
+    });
+    auto [first, second] = stdexec::sync_wait(stdexec::when_all(as_sender<int>(later), as_sender<int>(resolve(3)))).value();
+    resolver.join();
+    delete saved;
+    expect(first == 2 && second == 3, "when_all over promises");
+
+    expect(stdexec::sync_wait(as_sender<void>(resolve())).has_value(), "as_sender<void> completes with no value");
+
+    // A sender settles a promise.
+    int x = 0;
+    int y = 0;
+    from_sender(stdexec::just(1, 2)).then([&x, &y](int a, int b) {
+        x = a;
+        y = b;
+    });
+    expect(x == 1 && y == 2, "from_sender resolves with the sender's values");
+
+    std::string senderError;
+    from_sender(stdexec::just_error(std::make_exception_ptr(std::runtime_error("sender failed")))).fail([&senderError](const std::runtime_error &err) {
+        senderError = err.what();
+    });
+    expect(senderError == "sender failed", "from_sender rejects with the sender's error");
+
+    bool stopped = false;
+    from_sender(stdexec::just_stopped()).fail([&stopped](const std::runtime_error &) {
+        stopped = true;
+    });
+    expect(stopped, "from_sender rejects a stopped sender");
+
+    // Round trip: promise -> sender algorithm -> promise.
+    int doubled = 0;
+    from_sender(as_sender<int>(resolve(4)) | stdexec::then([](int value) {
+        return value * 2;
+    })).then([&doubled](int value) {
+        doubled = value;
+    });
+    expect(doubled == 8, "as_sender and from_sender round trip");
+
+    // when_all() asks its other children to stop once one fails, which cancels the promise.
+    Promise never = newPromise([](Defer &) {});
+    std::string whenAllError;
+    try {
+        stdexec::sync_wait(stdexec::when_all(as_sender<int>(never), as_sender<int>(reject(std::runtime_error("other failed")))));
+    }
+    catch (const std::runtime_error &err) {
+        whenAllError = err.what();
+    }
+    std::string cancelReason;
+    never.fail([&cancelReason](const std::runtime_error &err) {
+        cancelReason = err.what();
+    });
+    expect(whenAllError == "other failed" && cancelReason == "sender stopped", "a stop request cancels the promise");
+
+    // Cancelling the promise of from_sender() stops the sender.
+    Promise source = newPromise([](Defer &) {});
+    Promise bridged = from_sender(as_sender<int>(source));
+    bridged.reject(std::runtime_error("cancelled"));
+    bridged.fail([](const any &) {});
+    std::string sourceReason;
+    source.fail([&sourceReason](const std::runtime_error &err) {
+        sourceReason = err.what();
+    });
+    expect(sourceReason == "sender stopped", "cancelling from_sender() stops the sender");
+
+    // schedule() runs on the Service thread.
+    Service service;
+    service.setAutoStop(false);
+    std::thread loop([&service]() {
+        service.run();
+    });
+    std::thread::id loopId = loop.get_id();
+    auto [ranOn] = stdexec::sync_wait(stdexec::schedule(as_scheduler(service)) | stdexec::then([]() {
+        return std::this_thread::get_id();
+    })).value();
+    service.stop();
+    loop.join();
+    expect(ranOn == loopId, "schedule() completes on the executor");
+    return report();
+}
@@ -0,0 +1,80 @@
+#include <string>
+#include <thread>
+#include "async-promise/promise.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "test_util.hpp"
+using namespace promise;
+// Yields until the flag is set; each round queues one task for the next tick.
+static void spin(Service &service, const bool &done, int &rounds) {
+    service.yield().then([&service, &done, &rounds]() {
+        ++rounds;
+        if (!done) spin(service, done, rounds);
+    });
+}
+int main() {
+    {
+        // Tasks queued while a tick runs go after the ones it took.
+        Service service;
+        std::string order;
+        service.yield().then([&service, &order]() {
+            order += "a";
+            service.yield().then([&order]() {
+                order += "c";
+            });
+        });
+        service.yield().then([&order]() {
+            order += "b";
+        });
+        service.run();
+        expect(order == "abc", "tasks run in the order they were queued");
+    }
+    {
+        // A task that keeps queueing more does not hold back an expired timer.
+        Service service;
+        bool done = false;
+        int rounds = 0;
+        service.delay(5).then([&done]() {
+            done = true;
+        });
+        spin(service, done, rounds);
+        service.run();
+        expect(done && rounds > 0, "an expired timer fires while tasks keep coming");
+    }
+    {
+        // A timer added from another thread wakes an idle run().
+        Service service;
+        service.setAutoStop(false);
+        bool fired = false;
+        std::thread other([&service, &fired]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            service.delay(1).then([&service, &fired]() {
+                fired = true;
+                service.stop();
+            });
+        });
+        service.run();
+        other.join();
+        expect(fired, "delay() from another thread wakes run()");
+    }
+    {
+        // runInIoThread() from another thread runs the function on the service thread, even when
+        // run() takes the task before runInIoThread() has returned.
+        bool onServiceThread = true;
+        for (int round = 0; round < 200; ++round) {
+            Service service;
+            service.setAutoStop(false);
+            std::thread::id ranOn;
+            std::thread other([&service, &ranOn]() {
+                service.runInIoThread([&service, &ranOn]() {
+                    ranOn = std::this_thread::get_id();
+                    service.stop();
+                });
+            });
+            service.run();
+            other.join();
+            if (ranOn != std::this_thread::get_id()) onServiceThread = false;
+        }
+        expect(onServiceThread, "runInIoThread() runs the function on the service thread");
+    }
+    return report();
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "extensions/task_scheduler/stream.hpp"
+#include "test_util.hpp"
+using namespace promise;
+
+int main() {
+    {
+        Service service;
+        Stream<int> source(service);
+        std::vector<std::string> seen;
+        bool closed = false;
+        source.filter([](int value) {
+            return value % 2 == 0;
+        }).map([](int value) {
+            return std::to_string(value * 10);
+        }).subscribe([&seen](const std::string &value) {
+            seen.push_back(value);
+        }, [&closed]() {
+            closed = true;
+        });
+        std::vector<std::vector<int>> batches;
+        source.buffer(3).subscribe([&batches](const std::vector<int> &batch) {
+            batches.push_back(batch);
+        });
+        int first = 0, last = 0;
+        source.first().then([&first](int value) {
+            first = value;
+        });
+        source.last().then([&last](int value) {
+            last = value;
+        });
+        for (int i = 1; i <= 7; ++i)
+            source.push(i);
+        expect(first == 1 && last == 0, "first() resolves at once, last() waits for close");
+        expect(batches.size() == 2 && batches[1] == std::vector<int>({ 4, 5, 6 }), "buffer(3) emits full batches");
+        source.close();
+        source.push(8);
+        expect(seen == std::vector<std::string>({ "20", "40", "60" }), "filter and map");
+        expect(closed, "close() reaches subscribers of derived streams");
+        expect(batches.size() == 3 && batches[2] == std::vector<int>({ 7 }), "buffer flushes on close");
+        expect(last == 7, "last() resolves on close");
+
+        // A stream dropped without close() does not leave first() pending.
+        std::string dropped;
+        Stream<int>(service).first().fail([&dropped](const std::runtime_error &err) {
+            dropped = err.what();
+        });
+        expect(dropped == "stream destroyed", "first() of a destroyed stream rejects");
+        bool lastDropped = false;
+        {
+            Stream<int> unclosed(service);
+            unclosed.push(1);
+            unclosed.last().fail([&lastDropped](const std::runtime_error &) {
+                lastDropped = true;
+            });
+            unclosed.push(2);
+        }
+        expect(lastDropped, "last() of a destroyed stream rejects");
+
+        std::string error;
+        Stream<int> empty(service);
+        empty.last().fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        empty.close();
+        expect(error == "stream closed without values", "last() of an empty stream rejects");
+    }
+    {
+        // first() detaches once it has fired; subscribe() can be undone with unsubscribe().
+        Service service;
+        Stream<int> source(service);
+        int seen = 0;
+        Stream<int>::SubscriptionId id = source.subscribe([&seen](int) {
+            ++seen;
+        });
+        for (int i = 0; i < 100; ++i)
+            source.first();
+        expect(source.subscriberCount() == 101, "first() subscribes until it fires");
+        source.push(1);
+        expect(source.subscriberCount() == 1, "first() detaches once it has fired");
+        source.unsubscribe(id);
+        source.push(2);
+        expect(seen == 1 && source.subscriberCount() == 0, "unsubscribe() stops delivery");
+    }
+    {
+        Service service;
+        Stream<int> source(service);
+        std::string error;
+        bool gotValue = false;
+        source.map([](int value) -> int {
+            if (value < 0) throw std::runtime_error("negative");
+            return value;
+        }).subscribe([&gotValue](int) {
+            gotValue = true;
+        }, nullptr, [&error](const any &reason) {
+            try {
+                reason.rethrow();
+            }
+            catch (const std::runtime_error &err) {
+                error = err.what();
+            }
+        });
+        source.push(1);
+        source.push(-1);
+        expect(gotValue && error == "negative", "a throwing map rejects its stream");
+    }
+    {
+        // window() and debounce() run on Service timers; the source is driven from timers too.
+        Service service;
+        Stream<int> source(service);
+        std::vector<std::vector<int>> windows;
+        source.window(40).subscribe([&windows](const std::vector<int> &batch) {
+            windows.push_back(batch);
+        });
+        std::vector<int> debounced;
+        source.debounce(40).subscribe([&debounced](int value) {
+            debounced.push_back(value);
+        });
+        std::vector<int> throttled;
+        source.throttle(60).subscribe([&throttled](int value) {
+            throttled.push_back(value);
+        });
+        service.setTimer(0, [source](bool) {
+            source.push(1);
+        });
+        service.setTimer(5, [source](bool) {
+            source.push(2);
+        });
+        service.setTimer(10, [source](bool) {
+            source.push(3);
+        });
+        service.setTimer(150, [source](bool) {
+            source.push(4);
+        });
+        service.setTimer(155, [source](bool) {
+            source.close();
+        });
+        service.run();
+        expect(windows.size() == 2 && windows[0] == std::vector<int>({ 1, 2, 3 }) && windows[1] == std::vector<int>({ 4 }),
+               "window() batches by time and flushes on close");
+        expect(debounced == std::vector<int>({ 3, 4 }), "debounce() keeps the latest value of a burst");
+        expect(throttled == std::vector<int>({ 1, 4 }), "throttle() drops values inside the interval");
+    }
+    return report();
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "async-promise/sync.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "test_util.hpp"
+using namespace promise;
+int main() {
+    Service service;
+
+    // At most 3 of 10 "backend calls" run at once, and they start in FIFO order.
+    AsyncSemaphore semaphore(3);
+    int running = 0;
+    int maxRunning = 0;
+    std::vector<int> started;
+    for (int i = 0; i < 10; ++i) {
+        semaphore.run([&, i]() {
+            started.push_back(i);
+            maxRunning = std::max(maxRunning, ++running);
+            return service.delay(10).then([&running]() {
+                --running;
+            });
+        });
+    }
+
+    // A semaphore created with no permits works as a signal, and permits released beyond the
+    // initial count can be acquired together.
+    AsyncSemaphore signal(0);
+    int signalled = 0;
+    signal.acquire().then([&signalled]() {
+        ++signalled;
+    });
+    expect(signalled == 0, "zero-count semaphore waits for a release");
+    signal.release();
+    expect(signalled == 1, "release signals the waiter");
+    signal.release(2);
+    signal.acquire(2).then([&signalled]() {
+        ++signalled;
+    });
+    expect(signalled == 2, "acquire may take more permits than the initial count");
+
+    // The mutex hands ownership to waiters in the order they asked.
+    AsyncMutex mutex;
+    std::vector<int> order;
+    for (int i = 0; i < 5; ++i) {
+        mutex.lock().then([&, i]() {
+            order.push_back(i);
+            return service.yield();
+        }).then([&mutex]() {
+            mutex.unlock();
+        });
+    }
+
+    AsyncLatch latch(3);
+    bool latched = false;
+    latch.wait().then([&latched]() {
+        latched = true;
+    });
+    latch.countDown();
+    latch.countDown();
+    expect(!latched, "latch waits for the count");
+    latch.countDown();
+    expect(latched, "latch opens at zero");
+
+    AsyncBarrier barrier(2);
+    std::vector<size_t> phases;
+    for (int i = 0; i < 4; ++i) {
+        barrier.arriveAndWait().then([&phases](size_t phase) {
+            phases.push_back(phase);
+        });
+    }
+
+    service.run();
+
+    expect(maxRunning == 3, "semaphore caps concurrency");
+    expect(started == std::vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }), "semaphore is FIFO");
+    expect(semaphore.available() == 3, "semaphore permits returned");
+    expect(order == std::vector<int>({ 0, 1, 2, 3, 4 }), "mutex is FIFO");
+    expect(phases == std::vector<size_t>({ 0, 0, 1, 1 }), "barrier completes one phase per two arrivals");
+    bool noParties = false;
+    try {
+        AsyncBarrier empty(0);
+    }
+    catch (const std::invalid_argument &) {
+        noParties = true;
+    }
+    expect(noParties, "a barrier without parties is rejected");
+    return report();
+}
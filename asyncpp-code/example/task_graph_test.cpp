@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "async-promise/task_graph.hpp"
+#include "extensions/task_scheduler/simple_task.hpp"
+#include "extensions/task_scheduler/thread_pool.hpp"
+#include "test_util.hpp"
+using namespace promise;
+
+int main() {
+    using std::chrono::milliseconds;
+    {
+        // Diamond on a Service: config -> (users, quota) -> page. users is the slow branch.
+        Service service;
+        TaskGraph graph;
+        TaskGraph::NodeId config = graph.addNode("config", [&service](const std::vector<any> &) {
+            return service.delay(10).then([]() {
+                return 1;
+            });
+        });
+        TaskGraph::NodeId users = graph.addNode("users", [&service](const std::vector<any> &inputs) {
+            int base = inputs[0].cast<int>();
+            return service.delay(60).then([base]() {
+                return base + 10;
+            });
+        });
+        TaskGraph::NodeId quota = graph.addNode("quota", [&service](const std::vector<any> &inputs) {
+            int base = inputs[0].cast<int>();
+            return service.delay(5).then([base]() {
+                return base + 100;
+            });
+        });
+        TaskGraph::NodeId page = graph.addNode("page", [](const std::vector<any> &inputs) {
+            return resolve(inputs[0].cast<int>() + inputs[1].cast<int>());
+        });
+        graph.addEdge(config, users);
+        graph.addEdge(config, quota);
+        graph.addEdge(users, page);
+        graph.addEdge(quota, page);
+        bool done = false;
+        graph.run(service).then([&done]() {
+            done = true;
+        });
+        service.run();
+        expect(done, "graph resolves when every node has");
+        expect(graph.result(page).cast<int>() == 112, "nodes get their dependencies' results in edge order");
+
+        TaskGraph::Stats stats = graph.stats();
+        expect(stats.criticalPath_ == std::vector<TaskGraph::NodeId>({ config, users, page }), "critical path follows the slow branch");
+        expect(stats.nodes_[users].startedAt_ == stats.nodes_[quota].startedAt_
+               || stats.nodes_[quota].startedAt_ < stats.nodes_[users].startedAt_ + stats.nodes_[users].duration_,
+               "independent branches overlap");
+        expect(stats.nodes_[users].duration_ >= milliseconds(60) && stats.total_ >= milliseconds(70), "per-node timing");
+
+        std::string error;
+        graph.run(service).fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        expect(error == "task graph already ran", "a graph runs once");
+        int addsRejected = 0;
+        try {
+            graph.addNode("late", nullptr);
+        }
+        catch (const std::logic_error &) {
+            ++addsRejected;
+        }
+        try {
+            graph.addEdge(config, users);
+        }
+        catch (const std::logic_error &) {
+            ++addsRejected;
+        }
+        expect(addsRejected == 2, "nodes and edges cannot be added after run()");
+    }
+    {
+        // Independent nodes on a worker pool run in parallel.
+        ThreadPool pool(4);
+        TaskGraph graph;
+        std::atomic<int> onWorkers{ 0 };
+        const std::thread::id mainThread = std::this_thread::get_id();
+        for (int i = 0; i < 4; ++i) {
+            graph.addNode("sleep" + std::to_string(i), [&onWorkers, mainThread, i](const std::vector<any> &) {
+                if (std::this_thread::get_id() != mainThread) ++onWorkers;
+                std::this_thread::sleep_for(milliseconds(50));
+                return resolve(i);
+            });
+        }
+        auto begin = std::chrono::steady_clock::now();
+        expect(graph.run(pool).wait(std::chrono::seconds(5)), "pool graph completes");
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        expect(onWorkers == 4, "node functions run on the pool");
+        expect(elapsed < milliseconds(150), "pool nodes overlap");
+        expect(graph.stats().criticalPath_.size() == 1, "critical path of independent nodes is one node");
+    }
+    {
+        // A failure rejects the run and stops the nodes behind it.
+        TaskGraph graph;
+        bool dependentRan = false;
+        TaskGraph::NodeId first = graph.addNode("first", [](const std::vector<any> &) -> Promise {
+            throw std::runtime_error("node failed");
+        });
+        TaskGraph::NodeId second = graph.addNode("second", [&dependentRan](const std::vector<any> &) {
+            dependentRan = true;
+            return resolve();
+        });
+        graph.addEdge(first, second);
+        std::string error;
+        graph.run().fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        expect(error == "node failed" && !dependentRan, "failure rejects the graph");
+        expect(!graph.stats().nodes_[first].finished_, "failed node is not finished");
+
+        TaskGraph cyclic;
+        TaskGraph::NodeId a = cyclic.addNode("a", [](const std::vector<any> &) { return resolve(); });
+        TaskGraph::NodeId b = cyclic.addNode("b", [](const std::vector<any> &) { return resolve(); });
+        cyclic.addEdge(a, b);
+        cyclic.addEdge(b, a);
+        cyclic.run().fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        expect(error == "task graph has a cycle", "cycles are rejected");
+    }
+    return report();
+}
@@ -0,0 +1,20 @@
+#pragma once
+#ifndef INC_TEST_UTIL_HPP_
+#define INC_TEST_UTIL_HPP_
+#include <stdio.h>
+// Checks shared by the example tests: expect() reports each failed check and main() ends with
+// return report(), which prints PASS and exits with 0 only if every check held.
+inline int s_failed = 0;
+inline void expect(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        ++s_failed;
+    }
+}
+inline int report() {
+    if (s_failed != 0)
+        return 1;
+    printf("PASS\n");
+    return 0;
+}
+#endif
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "async-promise/trace.hpp"
+#include "test_util.hpp"
+using namespace promise;
+static size_t countOf(const std::string &text, const std::string &needle) {
+    size_t count = 0;
+    for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + needle.size()))
+        ++count;
+    return count;
+}
+static std::string pointer(const void *address) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%p", address);
+    return buf;
+}
+
+int main() {
+    {
+        // Nothing is recorded while tracing is off.
+        Tracer::clear();
+        resolve(1).then([](int) {});
+        expect(Tracer::snapshot().empty(), "disabled tracer records nothing");
+    }
+    {
+        // A resolved chain: create, settle, then one begin/end pair per handler.
+        Tracer::enable(true);
+        Tracer::clear();
+        std::vector<Defer> defers;
+        int value = 0;
+        newPromise([&defers](Defer &defer) {
+            defers.push_back(defer);
+        }).then([](int v) {
+            return v + 1;
+        }).then([&value](int v) {
+            value = v;
+        });
+        defers.front().resolve(1);
+        Tracer::enable(false);
+        expect(value == 2, "traced chain still runs");
+
+        std::vector<TraceRecord> records = Tracer::snapshot();
+        expect(records.size() == 6, "create, settle and two continuations are recorded");
+        expect(!records.empty() && records.front().event_ == TraceEvent::kCreate, "creation comes first");
+        const void *holder = (records.empty() ? nullptr : records.front().promiseHolder_);
+        bool sameHolder = true;
+        bool ordered = true;
+        for (size_t i = 0; i < records.size(); ++i) {
+            sameHolder = sameHolder && records[i].promiseHolder_ == holder;
+            ordered = ordered && (i == 0 || records[i - 1].timestampNs_ <= records[i].timestampNs_);
+        }
+        expect(sameHolder && ordered, "records are per holder, in time order");
+
+        std::string json = Tracer::dumpChromeTrace();
+        expect(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0 && json.find("]}\n") == json.size() - 3,
+               "dump is a Chrome trace object");
+        expect(countOf(json, "\"name\":\"newPromise\",\"cat\":\"promise\",\"ph\":\"i\"") == 1, "newPromise instant event");
+        expect(countOf(json, "\"name\":\"resolve\",\"cat\":\"promise\",\"ph\":\"i\"") == 1, "resolve instant event");
+        expect(countOf(json, "\"name\":\"onResolved\",\"cat\":\"promise\",\"ph\":\"B\"") == 2
+               && countOf(json, "\"name\":\"onResolved\",\"cat\":\"promise\",\"ph\":\"E\"") == 2, "continuations are begin/end pairs");
+        expect(countOf(json, "\"promise\":\"" + pointer(holder) + "\"") == 6, "events name the promise");
+        expect(json.find("\"name\":\"onResolved\",\"cat\":\"promise\",\"ph\":\"B\"") > json.find("\"name\":\"resolve\""),
+               "continuations follow the settle");
+    }
+    {
+        // A rejection is traced as reject / onRejected.
+        Tracer::enable(true);
+        Tracer::clear();
+        std::string error;
+        newPromise([](Defer &defer) {
+            defer.reject(std::runtime_error("traced"));
+        }).fail([&error](const std::runtime_error &err) {
+            error = err.what();
+        });
+        Tracer::enable(false);
+        std::string json = Tracer::dumpChromeTrace();
+        expect(error == "traced", "traced rejection is handled");
+        expect(countOf(json, "\"name\":\"reject\"") == 1 && countOf(json, "\"name\":\"onRejected\"") == 2,
+               "rejection and its handler are recorded");
+
+        Tracer::clear();
+        expect(Tracer::dumpChromeTrace() == "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[]}\n", "clear() empties the trace");
+    }
+    return report();
+}
@@ -0,0 +1,200 @@
+#pragma once
+#ifndef INC_ASYNC_CACHE_HPP_
+#define INC_ASYNC_CACHE_HPP_
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "async-promise/single_flight.hpp"
+#include "simple_task.hpp"
+// Async memo cache: get(key, factory) resolves with a cached Value, or with the result of one
+// factory() call shared by concurrent misses on the key. Holds at most maxEntries values in LRU
+// order, each expiring ttlMs after it was stored; rejections are not cached, and a load whose
+// key is invalidated meanwhile answers its callers without being stored.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class AsyncCache {
+    using Promise   = promise::Promise;
+    using Clock     = std::chrono::steady_clock;
+    using TimePoint = std::chrono::time_point<Clock>;
+    using Expiries  = std::multimap<TimePoint, Key>;
+    struct Entry {
+        Key                         key_;
+        Value                       value_;
+        typename Expiries::iterator expiry_;
+    };
+    using Lru = std::list<Entry>;
+    using Entries = std::unordered_map<Key, typename Lru::iterator, Hash>;
+    struct State {
+        State(Service &service, size_t maxEntries, uint64_t ttlMs)
+            : service_(service)
+            , maxEntries_(maxEntries)
+            , ttl_(std::chrono::milliseconds(ttlMs))
+            , timerArmed_(false) {
+        }
+        std::mutex                                              mutex_;
+        Service                                                &service_;
+        const size_t                                            maxEntries_;
+        const std::chrono::milliseconds                         ttl_;
+        Lru                                                     lru_; // most recently used first
+        Entries                                                 entries_;
+        Expiries                                                expiries_; // one per entry
+        std::unordered_map<Key, uint64_t, Hash>                 loads_; // generation of the load in flight per key
+        uint64_t                                                generation_ = 0;
+        bool                                                    timerArmed_;
+    };
+public:
+    AsyncCache(Service &service, size_t maxEntries, uint64_t ttlMs)
+        : state_(std::make_shared<State>(service, maxEntries, ttlMs)) {
+    }
+
+    // factory() may return a Value or a Promise resolving with one.
+    template<typename FUNC>
+    Promise get(const Key &key, FUNC &&factory) {
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            auto found = state_->entries_.find(key);
+            if (found != state_->entries_.end()) {
+                if (found->second->expiry_->first > Clock::now()) {
+                    state_->lru_.splice(state_->lru_.begin(), state_->lru_, found->second);
+                    return promise::resolve(found->second->value_);
+                }
+                erase(*state_, found);
+            }
+        }
+        std::weak_ptr<State> weak = state_;
+        return flights_.run(key, [weak, key, factory = std::forward<FUNC>(factory)]() {
+            // Only the caller that starts the load gets here; invalidate() drops its generation.
+            uint64_t generation = 0;
+            if (std::shared_ptr<State> state = weak.lock()) {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                generation = ++state->generation_;
+                state->loads_[key] = generation;
+            }
+            return promise::resolve().then(factory).then([weak, key, generation](const Value &value) {
+                if (std::shared_ptr<State> state = weak.lock())
+                    store(state, key, value, generation);
+                return value;
+            }).finally([weak, key, generation]() {
+                if (std::shared_ptr<State> state = weak.lock())
+                    landed(*state, key, generation);
+            });
+        });
+    }
+    void invalidate(const Key &key) {
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            state_->loads_.erase(key);
+            auto found = state_->entries_.find(key);
+            if (found != state_->entries_.end())
+                erase(*state_, found);
+        }
+        flights_.forget(key);
+    }
+    void clear() {
+        std::vector<Key> loading;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            state_->lru_.clear();
+            state_->entries_.clear();
+            state_->expiries_.clear();
+            loading.reserve(state_->loads_.size());
+            for (const auto &load : state_->loads_)
+                loading.push_back(load.first);
+            state_->loads_.clear();
+        }
+        for (const Key &key : loading)
+            flights_.forget(key);
+    }
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->entries_.size();
+    }
+
+private:
+    // Stores the result of the load of the given generation, unless it was invalidated.
+    static void store(const std::shared_ptr<State> &state, const Key &key, const Value &value, uint64_t generation) {
+        std::optional<uint64_t> waitMs;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            auto load = state->loads_.find(key);
+            if (load == state->loads_.end() || load->second != generation) return;
+            state->loads_.erase(load);
+            if (state->maxEntries_ == 0) return;
+            auto expiry = state->expiries_.emplace_hint(state->expiries_.end(), Clock::now() + state->ttl_, key);
+            auto found = state->entries_.find(key);
+            if (found != state->entries_.end()) {
+                found->second->value_ = value;
+                state->expiries_.erase(found->second->expiry_);
+                found->second->expiry_ = expiry;
+                state->lru_.splice(state->lru_.begin(), state->lru_, found->second);
+            }
+            else {
+                state->lru_.push_front(Entry{ key, value, expiry });
+                state->entries_.emplace(key, state->lru_.begin());
+                if (state->entries_.size() > state->maxEntries_)
+                    erase(*state, state->entries_.find(state->lru_.back().key_));
+            }
+            waitMs = arm(*state);
+        }
+        if (waitMs) startTimer(state, *waitMs);
+    }
+
+    // Forgets a load that failed; one that was stored or invalidated is already gone.
+    static void landed(State &state, const Key &key, uint64_t generation) {
+        std::lock_guard<std::mutex> lock(state.mutex_);
+        auto load = state.loads_.find(key);
+        if (load != state.loads_.end() && load->second == generation)
+            state.loads_.erase(load);
+    }
+
+    // Called with the lock held.
+    static void erase(State &state, typename Entries::iterator found) {
+        state.expiries_.erase(found->second->expiry_);
+        state.lru_.erase(found->second);
+        state.entries_.erase(found);
+    }
+
+    // Claims the expiry timer unless it is running and returns its wait. Called with the lock held.
+    static std::optional<uint64_t> arm(State &state) {
+        if (state.timerArmed_ || state.expiries_.empty()) return std::nullopt;
+        state.timerArmed_ = true;
+        auto wait = state.expiries_.begin()->first - Clock::now();
+        return (uint64_t)std::max<int64_t>(0, std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+    }
+    static void startTimer(const std::shared_ptr<State> &state, uint64_t waitMs) {
+        std::weak_ptr<State> weak = state;
+        state->service_.delay(waitMs).then([weak]() {
+            if (std::shared_ptr<State> state = weak.lock())
+                expire(state);
+        }, [weak]() {
+            if (std::shared_ptr<State> state = weak.lock()) {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                state->timerArmed_ = false;
+            }
+        });
+    }
+
+    static void expire(const std::shared_ptr<State> &state) {
+        std::optional<uint64_t> waitMs;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            state->timerArmed_ = false;
+            TimePoint now = Clock::now();
+            while (!state->expiries_.empty() && state->expiries_.begin()->first <= now)
+                erase(*state, state->entries_.find(state->expiries_.begin()->second));
+            waitMs = arm(*state);
+        }
+        if (waitMs) startTimer(state, *waitMs);
+    }
+
+    std::shared_ptr<State>   state_;
+    promise::SingleFlight<Key, Hash> flights_;
+};
+#endif
@@ -0,0 +1,163 @@
+#pragma once
+#ifndef INC_BATCHER_HPP_
+#define INC_BATCHER_HPP_
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "simple_task.hpp"
+// DataLoader-style batching: load(key) calls are collected and dispatched together as one
+// batchFn(keys) call, whose Promise must resolve with a std::vector<Value> in key order.
+// Results are split back to the callers; a rejected batch rejects every caller in it.
+// A batch is dispatched when it reaches maxBatchSize, or on the next Service tick
+// (maxWaitMs == 0, via yield()) / after maxWaitMs (via delay()) from its first load().
+// Duplicate keys within a batch are sent once.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class Batcher {
+    using Defer   = promise::Defer;
+    using Promise = promise::Promise;
+public:
+    using BatchFn = std::function<Promise(const std::vector<Key> &keys)>;
+private:
+    struct Load {
+        Key   key_;
+        Defer defer_;
+    };
+    struct State {
+        State(Service &service, BatchFn batchFn, size_t maxBatchSize, uint64_t maxWaitMs)
+            : service_(service)
+            , batchFn_(std::move(batchFn))
+            , maxBatchSize_(maxBatchSize == 0 ? 1 : maxBatchSize)
+            , maxWaitMs_(maxWaitMs)
+            , generation_(0)
+            , scheduled_(false) {
+        }
+        std::mutex        mutex_;
+        Service          &service_;
+        const BatchFn     batchFn_;
+        const size_t      maxBatchSize_;
+        const uint64_t    maxWaitMs_;
+        std::vector<Load> pending_;
+        uint64_t          generation_; // bumped on every dispatch, so stale flush timers do nothing
+        bool              scheduled_;
+    };
+public:
+    Batcher(Service &service, BatchFn batchFn, size_t maxBatchSize, uint64_t maxWaitMs = 0)
+        : state_(std::make_shared<State>(service, std::move(batchFn), maxBatchSize, maxWaitMs)) {
+    }
+
+    Promise load(const Key &key) {
+        std::vector<Load> batch;
+        std::optional<uint64_t> tick; // generation to schedule a flush for
+        std::optional<Defer> defer;
+        Promise promise = promise::newPromise([&defer](Defer &pending) {
+            defer = pending;
+        });
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            state_->pending_.push_back(Load{ key, *defer });
+            if (state_->pending_.size() >= state_->maxBatchSize_) {
+                batch = take(*state_);
+            }
+            else if (!state_->scheduled_) {
+                state_->scheduled_ = true;
+                tick = state_->generation_;
+            }
+        }
+        // Outside the lock: the tick handlers take it, also when the Service stops.
+        if (tick)
+            schedule(state_, *tick);
+        if (!batch.empty())
+            dispatch(state_, std::move(batch));
+        return promise;
+    }
+    // Dispatches whatever is pending now.
+    void flush() {
+        std::vector<Load> batch;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            batch = take(*state_);
+        }
+        if (!batch.empty())
+            dispatch(state_, std::move(batch));
+    }
+
+private:
+    // Called with the lock held.
+    static std::vector<Load> take(State &state) {
+        std::vector<Load> batch;
+        batch.swap(state.pending_);
+        state.pending_.reserve(state.maxBatchSize_);
+        state.scheduled_ = false;
+        ++state.generation_;
+        return batch;
+    }
+
+    // Called without the lock; a tick for an older generation does nothing.
+    static void schedule(const std::shared_ptr<State> &state, uint64_t generation) {
+        std::weak_ptr<State> weak = state;
+        Promise tick = (state->maxWaitMs_ == 0 ? state->service_.yield() : state->service_.delay(state->maxWaitMs_));
+        tick.then([weak, generation]() {
+            std::shared_ptr<State> state = weak.lock();
+            if (!state) return;
+            std::vector<Load> batch;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                if (state->generation_ != generation) return;
+                batch = take(*state);
+            }
+            if (!batch.empty())
+                dispatch(state, std::move(batch));
+        }, [weak, generation](const promise::any &arg) {
+            // The service stopped before the batch went out.
+            std::shared_ptr<State> state = weak.lock();
+            if (!state) return;
+            std::vector<Load> batch;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                if (state->generation_ != generation) return;
+                batch = take(*state);
+            }
+            promise::DeferBatch defers;
+            for (const Load &load : batch)
+                defers.add(load.defer_);
+            defers.reject(arg);
+        });
+    }
+
+    // The callers of each key are settled together, with the value boxed once.
+    static void dispatch(const std::shared_ptr<State> &state, std::vector<Load> batch) {
+        std::vector<Key> keys;
+        auto callers = std::make_shared<std::vector<std::vector<Defer>>>(); // per key, in keys order
+        keys.reserve(batch.size());
+        std::unordered_map<Key, size_t, Hash> seen;
+        for (const Load &load : batch) {
+            auto found = seen.try_emplace(load.key_, keys.size());
+            if (found.second) {
+                keys.push_back(load.key_);
+                callers->emplace_back();
+            }
+            (*callers)[found.first->second].push_back(load.defer_);
+        }
+        const BatchFn &batchFn = state->batchFn_;
+        promise::resolve().then([batchFn, keys]() {
+            return batchFn(keys);
+        }).then([callers](const std::vector<Value> &values) {
+            if (values.size() != callers->size())
+                throw std::runtime_error("batch returned a different number of values than keys");
+            for (size_t i = 0; i < values.size(); ++i)
+                promise::resolveAll((*callers)[i], values[i]);
+        }).fail([callers](const promise::any &arg) {
+            for (const std::vector<Defer> &defers : *callers)
+                promise::rejectAll(defers, arg);
+        });
+    }
+
+    std::shared_ptr<State> state_;
+};
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef INC_DEADLINE_HPP_
+#define INC_DEADLINE_HPP_
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include "async-promise/promise.hpp"
+#include "simple_task.hpp"
+namespace promise {
+// Rejection value of a withDeadline() that ran out of time.
+class TimeoutError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Settles like promise, or rejects with TimeoutError once deadline passes and cancels promise
+// with it. The earlier of deadline and currentDeadline() also bounds the handlers attached to
+// promise so far (see setDeadline()), not later consumers.
+inline Promise withDeadline(Service &service, Promise promise, std::chrono::steady_clock::time_point deadline) {
+    deadline = std::min(deadline, currentDeadline());
+    setDeadline(promise, deadline);
+    Promise result = newPromise([&](Defer &defer) {
+        auto wait = deadline - std::chrono::steady_clock::now();
+        uint64_t waitMs = (uint64_t)std::max<int64_t>(0,
+            std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+        auto settled = std::make_shared<std::atomic<bool>>(false);
+        Service::TimerId id = service.setTimer(waitMs, [defer, promise, settled](bool fired) {
+            if (settled->exchange(true)) return;
+            if (!fired) {
+                defer.reject(std::runtime_error("service stopped"));
+                return;
+            }
+            TimeoutError error("deadline exceeded");
+            defer.reject(error);
+            promise.reject(error);
+        });
+        Service *pservice = &service;
+        promise.then([defer, settled, pservice, id](const any &arg) {
+            if (settled->exchange(true)) return KeepOutcome();
+            pservice->cancelTimer(id);
+            defer.resolve(arg);
+            return KeepOutcome();
+        }, [defer, settled, pservice, id](const any &arg) {
+            if (settled->exchange(true)) return KeepOutcome();
+            pservice->cancelTimer(id);
+            defer.reject(arg);
+            return KeepOutcome();
+        });
+    });
+    return result;
+}
+inline Promise withDeadline(Service &service, Promise promise, uint64_t timeoutMs) {
+    return withDeadline(service, std::move(promise),
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs));
+}
+}
+#endif
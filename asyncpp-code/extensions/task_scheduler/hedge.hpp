@@ -0,0 +1,187 @@
+#pragma once
+#ifndef INC_HEDGE_HPP_
+#define INC_HEDGE_HPP_
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "simple_task.hpp"
+namespace promise {
+namespace detail {
+struct HedgeState {
+    std::mutex                     mutex_;
+    Service                       &service_;
+    const std::function<any()>     factory_;
+    const uint64_t                 delayMs_;
+    const size_t                   maxAttempts_;
+    std::vector<Promise>           attempts_;
+    std::vector<bool>              settled_;
+    size_t                         failures_ = 0;
+    bool                           done_ = false;
+    Service::TimerId               timer_ = 0;
+    bool                           timerArmed_ = false;
+    uint64_t                       generation_ = 0; // bumped whenever the timer is replaced, so a stale one does nothing
+    std::unique_ptr<Defer>         defer_;
+    // Keeps the state alive until the hedge is decided. The attempts only hold it weakly, so one
+    // that never settles does not keep it, and what it owns, alive afterwards.
+    std::shared_ptr<HedgeState>    self_;
+
+    HedgeState(Service &service, std::function<any()> factory, uint64_t delayMs, size_t maxAttempts)
+        : service_(service)
+        , factory_(std::move(factory))
+        , delayMs_(delayMs)
+        , maxAttempts_(maxAttempts == 0 ? 1 : maxAttempts) {
+    }
+
+    // Starts the next attempt and, if more are allowed, the timer for the one after it.
+    // A timer passes its generation; an early retry passes none and replaces the pending timer.
+    // Service timers are set and cancelled outside the lock.
+    static void launch(const std::shared_ptr<HedgeState> &state, std::optional<uint64_t> fromTimer = std::nullopt) {
+        size_t index;
+        std::optional<Service::TimerId> stale;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            if (state->done_ || state->attempts_.size() == state->maxAttempts_) return;
+            if (fromTimer && *fromTimer != state->generation_) return;
+            stale = takeTimer(*state);
+            index = state->attempts_.size();
+            state->attempts_.push_back(Promise());
+            state->settled_.push_back(false);
+        }
+        if (stale) state->service_.cancelTimer(*stale);
+        const std::function<any()> &factory = state->factory_;
+        Promise attempt = resolve().then([factory]() {
+            return factory();
+        });
+        std::optional<uint64_t> generation;
+        bool late;
+        {
+            // Another attempt may have won while factory() ran; finish() did not see this one.
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            late = state->done_;
+            if (!late) {
+                state->attempts_[index] = attempt;
+                if (index + 1 < state->maxAttempts_)
+                    generation = state->generation_;
+            }
+        }
+        if (late) {
+            cancel({ attempt });
+            return;
+        }
+        if (generation) arm(state, *generation);
+        std::weak_ptr<HedgeState> weak = state;
+        attempt.then([weak, index](const any &arg) {
+            std::shared_ptr<HedgeState> state = weak.lock();
+            if (!state) return;
+            std::vector<Promise> losers;
+            std::optional<Service::TimerId> timer;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                state->settled_[index] = true;
+                if (state->done_) return;
+                losers = finish(*state, timer);
+            }
+            if (timer) state->service_.cancelTimer(*timer);
+            state->defer_->resolve(arg);
+            cancel(losers);
+        }, [weak, index](const any &arg) {
+            std::shared_ptr<HedgeState> state = weak.lock();
+            if (!state) return;
+            std::vector<Promise> losers;
+            std::optional<Service::TimerId> timer;
+            bool retryNow = false;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                state->settled_[index] = true;
+                if (state->done_) return;
+                ++state->failures_;
+                if (state->failures_ < state->attempts_.size()) return;
+                // Everything launched so far failed: hedge right away instead of waiting.
+                if (state->attempts_.size() < state->maxAttempts_) {
+                    retryNow = true;
+                }
+                else {
+                    losers = finish(*state, timer);
+                }
+            }
+            if (retryNow) {
+                launch(state);
+                return;
+            }
+            if (timer) state->service_.cancelTimer(*timer);
+            state->defer_->reject(arg);
+            cancel(losers);
+        });
+    }
+
+    // Sets the timer for the next attempt, unless the timer generation moved on meanwhile.
+    static void arm(const std::shared_ptr<HedgeState> &state, uint64_t generation) {
+        std::weak_ptr<HedgeState> weak = state;
+        Service::TimerId id = state->service_.setTimer(state->delayMs_, [weak, generation](bool fired) {
+            if (!fired) return; // the service stopped
+            if (std::shared_ptr<HedgeState> state = weak.lock())
+                launch(state, generation);
+        });
+        {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            if (!state->done_ && state->generation_ == generation && !state->timerArmed_) {
+                state->timer_ = id;
+                state->timerArmed_ = true;
+                return;
+            }
+        }
+        state->service_.cancelTimer(id);
+    }
+
+    // Invalidates the pending timer and returns its id for cancelTimer(). Called with the lock held.
+    static std::optional<Service::TimerId> takeTimer(HedgeState &state) {
+        ++state.generation_;
+        if (!state.timerArmed_) return std::nullopt;
+        state.timerArmed_ = false;
+        return state.timer_;
+    }
+
+    // Marks the hedge decided and returns what must be cancelled. Called with the lock held,
+    // by a caller that holds the state. The slots are emptied but kept: a launch still running
+    // factory() indexes into them.
+    static std::vector<Promise> finish(HedgeState &state, std::optional<Service::TimerId> &timer) {
+        state.done_ = true;
+        state.self_.reset();
+        timer = takeTimer(state);
+        std::vector<Promise> losers;
+        for (size_t i = 0; i < state.attempts_.size(); ++i) {
+            if (!state.settled_[i] && state.attempts_[i]) losers.push_back(state.attempts_[i]);
+            state.attempts_[i] = Promise();
+        }
+        return losers;
+    }
+
+    static void cancel(const std::vector<Promise> &losers) {
+        for (const Promise &loser : losers)
+            loser.reject(std::runtime_error("cancelled by hedge"));
+    }
+};
+}
+
+// Hedged request: starts factory() and, each time delayMs passes without a success, starts
+// another attempt, up to maxAttempts in total. The first success wins and the attempts still
+// running are cancelled by rejecting them. If every attempt fails the hedge rejects with the
+// last error; when all running attempts have failed the next one starts without waiting.
+// factory may return a value, a Promise or nothing, like a then() callback.
+template<typename FUNC>
+inline Promise hedge(Service &service, FUNC &&factory, uint64_t delayMs, size_t maxAttempts) {
+    auto state = std::make_shared<detail::HedgeState>(service, [factory = std::forward<FUNC>(factory)]() -> any {
+        return any_call(factory, any());
+    }, delayMs, maxAttempts);
+    state->self_ = state;
+    Promise promise = newPromise([&state](Defer &defer) {
+        state->defer_.reset(new Defer(defer));
+    });
+    detail::HedgeState::launch(state);
+    return promise;
+}
+}
+#endif
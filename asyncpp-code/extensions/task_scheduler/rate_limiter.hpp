@@ -0,0 +1,176 @@
+#pragma once
+#ifndef INC_RATE_LIMITER_HPP_
+#define INC_RATE_LIMITER_HPP_
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include "async-promise/promise.hpp"
+#include "simple_task.hpp"
+// Token bucket that hands out permits as Promises.
+// Tokens refill continuously at `permitsPerSecond` up to `burst`. Waiters are queued FIFO and
+// the whole queue shares a single Service timer, armed for the moment the head of the queue
+// can be served; every expiry releases all waiters that fit as one DeferBatch.
+class RateLimiter {
+    using Defer     = promise::Defer;
+    using Promise   = promise::Promise;
+    using Clock     = std::chrono::steady_clock;
+    using TimePoint = std::chrono::time_point<Clock>;
+    struct Waiter {
+        Defer  defer_;
+        size_t permits_;
+    };
+    struct State {
+        State(Service &service, double permitsPerSecond, size_t burst)
+            : service_(service)
+            , permitsPerSecond_(permitsPerSecond)
+            , burst_((double)burst)
+            , tokens_((double)burst)
+            , refilledAt_(Clock::now())
+            , timerArmed_(false) {
+        }
+        std::mutex         mutex_;
+        Service           &service_;
+        double             permitsPerSecond_;
+        double             burst_;
+        double             tokens_;
+        TimePoint          refilledAt_;
+        std::deque<Waiter> waiters_;
+        bool               timerArmed_;
+    };
+public:
+    // The bucket starts full.
+    RateLimiter(Service &service, double permitsPerSecond, size_t burst)
+        : state_(std::make_shared<State>(service, permitsPerSecond, burst)) {
+        if (permitsPerSecond <= 0 || burst == 0)
+            throw std::invalid_argument("RateLimiter needs a positive rate and burst");
+    }
+    RateLimiter(const RateLimiter &) = delete;
+    RateLimiter &operator=(const RateLimiter &) = delete;
+    ~RateLimiter() {
+        promise::DeferBatch waiters;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            for (const Waiter &waiter : state_->waiters_)
+                waiters.add(waiter.defer_);
+            state_->waiters_.clear();
+        }
+        waiters.reject(std::runtime_error("rate limiter destroyed"));
+    }
+
+    // Resolves once `permits` tokens were taken. Requests larger than the burst can never be
+    // served and are rejected.
+    Promise acquire(size_t permits = 1) {
+        if ((double)permits > state_->burst_)
+            return promise::reject(std::runtime_error("permits exceed burst"));
+        std::optional<Defer> defer; // for the promise of an acquire that has to wait
+        Promise waiting;
+        while (true) {
+            bool granted = false;
+            bool queued = false;
+            std::optional<uint64_t> waitMs;
+            {
+                std::lock_guard<std::mutex> lock(state_->mutex_);
+                refill(*state_);
+                if (state_->waiters_.empty() && state_->tokens_ >= (double)permits) {
+                    state_->tokens_ -= (double)permits;
+                    granted = true;
+                }
+                else if (defer) {
+                    state_->waiters_.push_back(Waiter{ *defer, permits });
+                    waitMs = arm(*state_);
+                    queued = true;
+                }
+            }
+            if (queued) {
+                if (waitMs) startTimer(state_, *waitMs);
+                return waiting;
+            }
+            if (!granted) {
+                waiting = promise::newPromise([&defer](Defer &pending) {
+                    defer = pending;
+                });
+                continue;
+            }
+            if (!defer)
+                return promise::resolve();
+            defer->resolve();
+            return waiting;
+        }
+    }
+    bool tryAcquire(size_t permits = 1) {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        refill(*state_);
+        if (!state_->waiters_.empty() || state_->tokens_ < (double)permits)
+            return false;
+        state_->tokens_ -= (double)permits;
+        return true;
+    }
+    size_t waiting() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->waiters_.size();
+    }
+
+private:
+    static void refill(State &state) {
+        TimePoint now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - state.refilledAt_).count();
+        state.tokens_ = std::min(state.burst_, state.tokens_ + seconds * state.permitsPerSecond_);
+        state.refilledAt_ = now;
+    }
+
+    // Claims the shared timer for the head waiter unless it is already running, and returns
+    // how long it has to wait. Called with the lock held.
+    static std::optional<uint64_t> arm(State &state) {
+        if (state.timerArmed_ || state.waiters_.empty()) return std::nullopt;
+        state.timerArmed_ = true;
+        double missing = (double)state.waiters_.front().permits_ - state.tokens_;
+        return (uint64_t)std::ceil(missing * 1000.0 / state.permitsPerSecond_);
+    }
+    static void startTimer(const std::shared_ptr<State> &state, uint64_t waitMs) {
+        std::weak_ptr<State> weak = state;
+        state->service_.setTimer(waitMs, [weak](bool fired) {
+            std::shared_ptr<State> state = weak.lock();
+            if (!state) return;
+            if (fired) {
+                onTimer(state);
+                return;
+            }
+            // The service stopped, nothing will refill any more.
+            promise::DeferBatch waiters;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                state->timerArmed_ = false;
+                for (const Waiter &waiter : state->waiters_)
+                    waiters.add(waiter.defer_);
+                state->waiters_.clear();
+            }
+            waiters.reject(std::runtime_error("service stopped"));
+        });
+    }
+
+    static void onTimer(const std::shared_ptr<State> &state) {
+        promise::DeferBatch granted;
+        std::optional<uint64_t> waitMs;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            state->timerArmed_ = false;
+            refill(*state);
+            while (!state->waiters_.empty() && state->tokens_ >= (double)state->waiters_.front().permits_) {
+                state->tokens_ -= (double)state->waiters_.front().permits_;
+                granted.add(state->waiters_.front().defer_);
+                state->waiters_.pop_front();
+            }
+            waitMs = arm(*state);
+        }
+        if (waitMs) startTimer(state, *waitMs);
+        granted.resolve();
+    }
+
+    std::shared_ptr<State> state_;
+};
+#endif
@@ -0,0 +1,136 @@
+#pragma once
+#ifndef INC_RETRY_HPP_
+#define INC_RETRY_HPP_
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include "async-promise/promise.hpp"
+#include "simple_task.hpp"
+#include "deadline.hpp"
+namespace promise {
+struct RetryPolicy {
+    size_t   maxAttempts_    = 3;     // including the first attempt
+    uint64_t initialDelayMs_ = 100;   // backoff before the second attempt
+    double   multiplier_     = 2.0;   // backoff growth per attempt
+    uint64_t maxDelayMs_     = 10000;
+    double   jitter_         = 0.5;   // each backoff is scaled by a random factor in [1 - jitter, 1]
+    uint64_t deadlineMs_     = 0;     // total budget from the first attempt, 0 for none
+    // Called like a fail() handler with the error and returns bool, e.g.
+    // [](const std::runtime_error &err) { return isTransient(err); }.
+    // Errors it does not accept are not retried. Empty retries every error.
+    any      retryable_;
+};
+namespace detail {
+struct RetryState {
+    Service                          &service_;
+    const std::function<any()>        factory_;
+    const RetryPolicy                 policy_;
+    const std::chrono::steady_clock::time_point start_;
+    const std::chrono::steady_clock::time_point deadline_; // inherited from the caller's chain
+    size_t                            attempts_;
+    std::unique_ptr<Defer>            defer_;
+
+    RetryState(Service &service, std::function<any()> factory, const RetryPolicy &policy)
+        : service_(service)
+        , factory_(std::move(factory))
+        , policy_(policy)
+        , start_(std::chrono::steady_clock::now())
+        , deadline_(currentDeadline())
+        , attempts_(0) {
+    }
+
+    static void attempt(const std::shared_ptr<RetryState> &state) {
+        ++state->attempts_;
+        const std::function<any()> &factory = state->factory_;
+        Promise current = newPromise();
+        current.then([factory]() {
+            return factory();
+        });
+        setDeadline(current, state->deadline_);
+        current.resolve();
+        // A hung attempt is cut off at the total budget, so the retry still settles.
+        std::chrono::steady_clock::time_point deadline = state->budgetEnd();
+        if (deadline != std::chrono::steady_clock::time_point::max())
+            current = withDeadline(state->service_, current, deadline);
+        current.then([state](const any &arg) {
+            state->defer_->resolve(arg);
+        }, [state](const any &arg) {
+            uint64_t backoffMs;
+            if (!state->shouldRetry(arg, backoffMs)) {
+                state->defer_->reject(arg);
+                return;
+            }
+            // The sequence owns one pending Service timer at a time and no promise per wait.
+            state->service_.setTimer(backoffMs, [state](bool fired) {
+                if (fired)
+                    attempt(state);
+                else
+                    state->defer_->reject(std::runtime_error("service stopped"));
+            });
+        });
+    }
+
+    // The earlier of policy_.deadlineMs_ and the inherited deadline, time_point::max() for none.
+    std::chrono::steady_clock::time_point budgetEnd() const {
+        std::chrono::steady_clock::time_point end = deadline_;
+        if (policy_.deadlineMs_ != 0)
+            end = std::min(end, start_ + std::chrono::milliseconds(policy_.deadlineMs_));
+        return end;
+    }
+
+    bool shouldRetry(const any &error, uint64_t &backoffMs) const {
+        if (attempts_ >= policy_.maxAttempts_)
+            return false;
+        if (!policy_.retryable_.empty()) {
+            try {
+                if (!policy_.retryable_.call(error).cast<bool>())
+                    return false;
+            }
+            catch (...) {
+                return false; // the predicate does not take this kind of error
+            }
+        }
+        double backoff = (double)policy_.initialDelayMs_ * std::pow(policy_.multiplier_, (double)(attempts_ - 1));
+        backoff = std::min(backoff, (double)policy_.maxDelayMs_);
+        if (policy_.jitter_ > 0) {
+            static thread_local std::mt19937 random{ std::random_device{}() };
+            std::uniform_real_distribution<double> factor(1.0 - std::min(policy_.jitter_, 1.0), 1.0);
+            backoff *= factor(random);
+        }
+        backoffMs = (uint64_t)backoff;
+        if (policy_.deadlineMs_ != 0) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_);
+            if ((uint64_t)elapsed.count() + backoffMs >= policy_.deadlineMs_)
+                return false;
+        }
+        if (deadline_ != std::chrono::steady_clock::time_point::max()
+            && std::chrono::steady_clock::now() + std::chrono::milliseconds(backoffMs) >= deadline_)
+            return false;
+        return true;
+    }
+};
+}
+
+// Calls factory() until it succeeds, waiting an exponentially growing, jittered backoff between
+// attempts. Gives up with the last error after policy.maxAttempts_ attempts, when the next
+// attempt would start after policy.deadlineMs_ or the deadline of the calling chain (see
+// withDeadline()), or when policy.retryable_ rejects the error. Attempts inherit that deadline,
+// and one still running when the budget runs out is cancelled with a TimeoutError.
+// factory may return a value, a Promise or nothing, like a then() callback.
+template<typename FUNC>
+inline Promise retry(Service &service, FUNC &&factory, const RetryPolicy &policy = RetryPolicy()) {
+    auto state = std::make_shared<detail::RetryState>(service, [factory = std::forward<FUNC>(factory)]() -> any {
+        return any_call(factory, any());
+    }, policy);
+    Promise promise = newPromise([&state](Defer &defer) {
+        state->defer_.reset(new Defer(defer));
+    });
+    detail::RetryState::attempt(state);
+    return promise;
+}
+}
+#endif
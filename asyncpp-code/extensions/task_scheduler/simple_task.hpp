@@ -3,6 +3,10 @@
 #define INC_SIMPLE_TASK_HPP_
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <optional>
+#include <functional>
 #include <list>
 #include <deque>
 #include <chrono>
@@ -14,20 +18,33 @@
 #include <stdexcept>
 #include "async-promise/promise.hpp"
 class Service {
+public:
+    using TimerId   = uint64_t;
+private:
     using Defer     = promise::Defer;
     using Promise   = promise::Promise;
     using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
-    using Timers    = std::multimap<TimePoint, Defer>;
+    // A timer either resolves the Defer of a delay() or calls the function of a setTimer().
+    struct Timer {
+        TimerId                         id_;
+        std::optional<Defer>            defer_;
+        std::function<void(bool fired)> func_;
+    };
+    using Timers    = std::multimap<TimePoint, Timer>;
     using Tasks     = std::deque<Defer>;
     Timers timers_;
     Tasks  tasks_;
+    std::vector<std::function<void()>> posted_; // execute() tasks, run as one batch per tick
+    std::unordered_map<TimerId, Timers::iterator> timerIds_; // setTimer() timers, for cancelTimer()
+    TimerId nextTimerId_;
     mutable std::recursive_mutex mutex_;
     std::condition_variable_any cond_;
     std::atomic<bool> isAutoStop_;
     std::atomic<bool> isStop_;
 public:
     Service()
-        : isAutoStop_(true)
+        : nextTimerId_(0)
+        , isAutoStop_(true)
         , isStop_(false)
     {
     }
@@ -35,9 +52,30 @@ public:
         return promise::newPromise([&](Defer &defer) {
             TimePoint now = std::chrono::steady_clock::now();
             TimePoint time = now + std::chrono::milliseconds(time_ms);
-            timers_.emplace(time, defer);
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+            timers_.emplace(time, Timer{ 0, defer, {} });
+            cond_.notify_one();
         });
     }
+    // Calls func(true) on the service thread after time_ms, or func(false) if the service
+    // stops first. Cheaper than delay() when no Promise is needed, and can be cancelled.
+    TimerId setTimer(uint64_t time_ms, std::function<void(bool fired)> func) {
+        TimePoint time = std::chrono::steady_clock::now() + std::chrono::milliseconds(time_ms);
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        TimerId id = ++nextTimerId_;
+        timerIds_.emplace(id, timers_.emplace(time, Timer{ id, std::nullopt, std::move(func) }));
+        cond_.notify_one();
+        return id;
+    }
+    // Removes a setTimer() timer without calling it. Returns false if it already fired.
+    bool cancelTimer(TimerId id) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        auto found = timerIds_.find(id);
+        if (found == timerIds_.end()) return false;
+        timers_.erase(found->second);
+        timerIds_.erase(found);
+        return true;
+    }
     Promise yield() {
         return promise::newPromise([&](Defer &defer) {
             std::lock_guard<std::recursive_mutex> lock(mutex_);
@@ -45,66 +83,106 @@ public:
             cond_.notify_one();
         });
     }
+    // func is attached before the task is queued: run() may take the task at once, and a task
+    // resolved before then() would run func on the calling thread.
     void runInIoThread(const std::function<void()> &func) {
-        promise::newPromise([=](Defer &defer) {
-            std::lock_guard<std::recursive_mutex> lock(mutex_);
-            tasks_.push_back(defer);
-            cond_.notify_one();
+        std::optional<Defer> task;
+        promise::newPromise([&task](Defer &defer) {
+            task = defer;
         }).then([func]() {
             func();
         });
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        tasks_.push_back(*task);
+        cond_.notify_one();
+    }
+    // Executor interface (see promise::Executor): runs task on the service thread.
+    void execute(std::function<void()> task) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        posted_.push_back(std::move(task));
+        cond_.notify_one();
     }
     void setAutoStop(bool isAutoExit) {
         std::lock_guard<std::recursive_mutex> lock(mutex_);
         isAutoStop_ = isAutoExit;
         cond_.notify_one();
     }
+    // Promises bound to this service (setExecutor(), then_on()) that settle while it runs
+    // deliver inline, not one tick later.
     void run() {
+        promise::ExecutorScope scope(*this);
         std::unique_lock<std::recursive_mutex> lock(mutex_);
-        while(!isStop_ && (!isAutoStop_ || tasks_.size() > 0 || timers_.size() > 0)) {
-            if (tasks_.size() == 0 && timers_.size() == 0) {
+        while(!isStop_ && (!isAutoStop_ || tasks_.size() > 0 || timers_.size() > 0 || posted_.size() > 0)) {
+            if (tasks_.size() == 0 && timers_.size() == 0 && posted_.size() == 0) {
                 cond_.wait(lock);
                 continue;
             }
-            while (!isStop_ && timers_.size() > 0) {
-                TimePoint now = std::chrono::steady_clock::now();
-                TimePoint time = timers_.begin()->first;
-                if (time <= now) {
-                    Defer &defer = timers_.begin()->second;
-                    tasks_.push_back(defer);
-                    timers_.erase(timers_.begin());
-                }
-                else if (tasks_.size() == 0) {
-                    cond_.wait_for(lock, time - now);
+            // Queued tasks and every expired timer are collected here and settled
+            // outside the lock, so continuations can schedule more work.
+            promise::DeferBatch batch;
+            batch.reserve(tasks_.size());
+            while (tasks_.size() > 0) {
+                batch.add(tasks_.front());
+                tasks_.pop_front();
+            }
+            std::vector<std::function<void()>> posted;
+            posted.swap(posted_);
+            std::vector<std::function<void(bool)>> fired;
+            TimePoint now = std::chrono::steady_clock::now();
+            while (timers_.size() > 0 && timers_.begin()->first <= now) {
+                Timer &timer = timers_.begin()->second;
+                if (timer.defer_) {
+                    batch.add(*timer.defer_);
                 }
                 else {
-                    break;
+                    fired.push_back(std::move(timer.func_));
+                    timerIds_.erase(timer.id_);
                 }
+                timers_.erase(timers_.begin());
             }
-            if(!isStop_ && tasks_.size() > 0) {
-                size_t size = tasks_.size();
-                for(size_t i = 0; i < size; ++i){
-                    Defer defer = tasks_.front();
-                    tasks_.pop_front();
-                    {
-                        std::unique_lock<std::recursive_mutex> unlock(mutex_, std::adopt_lock);
-                        defer.resolve();
-                    }
-                    break;
-                }
+            if (batch.empty() && fired.empty() && posted.empty()) {
+                cond_.wait_until(lock, timers_.begin()->first);
+                continue;
             }
+            lock.unlock();
+            batch.resolve();
+            for (const std::function<void()> &task : posted)
+                task();
+            for (const std::function<void(bool)> &func : fired)
+                func(true);
+            lock.lock();
         }
-        while (timers_.size() > 0 || tasks_.size()) {
+        // What is left is collected under the lock and failed or run outside it, as above:
+        // posted tasks and timer functions take their own locks, and their owners call
+        // execute()/setTimer()/cancelTimer() while holding them.
+        while (timers_.size() > 0 || tasks_.size() > 0 || posted_.size() > 0) {
+            promise::DeferBatch batch;
+            std::vector<std::function<void(bool)>> cancelled;
             while (timers_.size() > 0) {
-                Defer defer = timers_.begin()->second;
+                Timer &timer = timers_.begin()->second;
+                if (timer.defer_) {
+                    batch.add(*timer.defer_);
+                }
+                else {
+                    cancelled.push_back(std::move(timer.func_));
+                    timerIds_.erase(timer.id_);
+                }
                 timers_.erase(timers_.begin());
-                defer.reject(std::runtime_error("service stopped"));
             }
             while (tasks_.size() > 0) {
-                Defer defer = tasks_.front();
+                batch.add(tasks_.front());
                 tasks_.pop_front();
-                defer.reject(std::runtime_error("service stopped"));
             }
+            // Posted tasks have no way to fail, so they still run, on this thread.
+            std::vector<std::function<void()>> posted;
+            posted.swap(posted_);
+            lock.unlock();
+            batch.reject(std::runtime_error("service stopped"));
+            for (const std::function<void(bool)> &func : cancelled)
+                func(false);
+            for (const std::function<void()> &task : posted)
+                task();
+            lock.lock();
         }
     }
     void stop() {
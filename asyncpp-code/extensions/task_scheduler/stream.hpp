@@ -0,0 +1,466 @@
+#pragma once
+#ifndef INC_STREAM_HPP_
+#define INC_STREAM_HPP_
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "async-promise/promise.hpp"
+#include "simple_task.hpp"
+namespace promise {
+// Push-based stream of values: the source calls push() for every event and close() or reject()
+// once at the end; subscribers see the values pushed after they subscribe (no replay). A stream
+// whose last copy goes away without either ends with a "stream destroyed" error.
+// Operators return a new Stream fed by this one. map/filter/buffer/throttle deliver on the
+// pushing thread; window and debounce deliver from Service timers, on the service thread.
+// buffer(n) and window(ms) emit std::vector<T> batches, so a high-rate source can be handled
+// one batch per continuation instead of one per event. Copies share the same stream.
+template<typename T>
+class Stream {
+public:
+    using SubscriptionId = uint64_t;
+private:
+    struct Subscriber {
+        std::function<void(const T &value)>   next_;
+        std::function<void(const any *error)> end_; // nullptr on close(), the reason on reject()
+        SubscriptionId                        id_ = 0; // 0: assigned by attach()
+    };
+    using Subscribers = std::vector<Subscriber>;
+    struct State {
+        explicit State(Service &service)
+            : service_(service)
+            , subscribers_(std::make_shared<const Subscribers>())
+            , ended_(false)
+            , failed_(false)
+            , nextId_(1) {
+        }
+        // A stream dropped without close() or reject() ends with an error, so pending first()
+        // and last() promises and derived streams do not wait forever.
+        ~State() {
+            if (ended_) return;
+            ended_ = true;
+            failed_ = true;
+            error_ = std::runtime_error("stream destroyed");
+            for (const Subscriber &subscriber : *subscribers_)
+                subscriber.end_(&error_);
+        }
+        std::mutex                         mutex_;
+        Service                           &service_;
+        std::shared_ptr<const Subscribers> subscribers_; // replaced on (un)subscribe, so push() does not copy it
+        bool                               ended_;
+        bool                               failed_;
+        any                                error_;
+        std::atomic<SubscriptionId>        nextId_;
+    };
+    using Clock = std::chrono::steady_clock;
+public:
+    explicit Stream(Service &service)
+        : state_(std::make_shared<State>(service)) {
+    }
+    Service &service() const {
+        return state_->service_;
+    }
+
+    // Delivers value to the current subscribers. Ignored once the stream has ended.
+    void push(const T &value) const {
+        std::shared_ptr<const Subscribers> subscribers;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            if (state_->ended_) return;
+            subscribers = state_->subscribers_;
+        }
+        for (const Subscriber &subscriber : *subscribers)
+            subscriber.next_(value);
+    }
+    // Ends the stream; subscribers get onClose, and buffering operators flush what they hold.
+    void close() const {
+        end(nullptr);
+    }
+    // Ends the stream with an error; buffered values downstream are dropped.
+    void reject(const any &reason) const {
+        end(&reason);
+    }
+    bool isEnded() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->ended_;
+    }
+
+    // Returns the id to pass to unsubscribe(). Subscribing to an ended stream calls
+    // onClose/onError at once and returns 0.
+    SubscriptionId subscribe(std::function<void(const T &value)> onNext,
+                             std::function<void()> onClose = nullptr,
+                             std::function<void(const any &error)> onError = nullptr) const {
+        return attach(Subscriber{ std::move(onNext), [onClose, onError](const any *error) {
+            if (error == nullptr) {
+                if (onClose) onClose();
+            }
+            else if (onError) {
+                onError(*error);
+            }
+        } });
+    }
+    // Stops calling the subscriber; its onClose/onError is not called. A push() already
+    // running on another thread may still deliver to it.
+    void unsubscribe(SubscriptionId id) const {
+        detach(state_, id);
+    }
+    // Number of attached subscribers, operators included; 0 once the stream has ended.
+    size_t subscriberCount() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->ended_ ? 0 : state_->subscribers_->size();
+    }
+
+    // Stream of func(value). An exception thrown by func rejects the result.
+    template<typename FUNC>
+    auto map(FUNC func) const -> Stream<std::decay_t<std::invoke_result_t<FUNC &, const T &>>> {
+        using U = std::decay_t<std::invoke_result_t<FUNC &, const T &>>;
+        Stream<U> out(service());
+        attach(Subscriber{ [out, func](const T &value) mutable {
+            std::optional<U> mapped;
+            try {
+                mapped.emplace(func(value));
+            }
+            catch (...) {
+                out.reject(std::current_exception());
+                return;
+            }
+            out.push(*mapped);
+        }, forwardEnd(out) });
+        return out;
+    }
+    // Stream of the values for which pred(value) is true.
+    template<typename PRED>
+    Stream<T> filter(PRED pred) const {
+        Stream<T> out(service());
+        attach(Subscriber{ [out, pred](const T &value) mutable {
+            bool keep;
+            try {
+                keep = pred(value);
+            }
+            catch (...) {
+                out.reject(std::current_exception());
+                return;
+            }
+            if (keep) out.push(value);
+        }, forwardEnd(out) });
+        return out;
+    }
+    // Batches of count values; the last, shorter batch is emitted on close().
+    Stream<std::vector<T>> buffer(size_t count) const {
+        struct Buffer {
+            std::mutex     mutex_;
+            std::vector<T> values_;
+        };
+        if (count == 0) count = 1;
+        Stream<std::vector<T>> out(service());
+        auto buffer = std::make_shared<Buffer>();
+        buffer->values_.reserve(count);
+        attach(Subscriber{ [out, buffer, count](const T &value) {
+            std::vector<T> batch;
+            {
+                std::lock_guard<std::mutex> lock(buffer->mutex_);
+                buffer->values_.push_back(value);
+                if (buffer->values_.size() < count) return;
+                batch.swap(buffer->values_);
+                buffer->values_.reserve(count);
+            }
+            out.push(batch);
+        }, [out, buffer](const any *error) {
+            std::vector<T> batch;
+            {
+                std::lock_guard<std::mutex> lock(buffer->mutex_);
+                batch.swap(buffer->values_);
+            }
+            if (error != nullptr) {
+                out.reject(*error);
+                return;
+            }
+            if (!batch.empty()) out.push(batch);
+            out.close();
+        } });
+        return out;
+    }
+    // Batches of the values that arrive within windowMs of the first value of each batch.
+    // One Service timer per batch; the open batch is emitted on close().
+    Stream<std::vector<T>> window(uint64_t windowMs) const {
+        struct Window {
+            explicit Window(const Stream<std::vector<T>> &out)
+                : out_(out)
+                , armed_(false)
+                , generation_(0) {
+            }
+            std::mutex                      mutex_;
+            Stream<std::vector<T>>          out_;
+            std::vector<T>                  values_;
+            std::optional<Service::TimerId> timer_;
+            bool                            armed_;
+            uint64_t                        generation_; // bumped per batch, so a stale timer does nothing
+            // Called with the lock held.
+            std::vector<T> take() {
+                std::vector<T> batch;
+                batch.swap(values_);
+                armed_ = false;
+                timer_.reset();
+                ++generation_;
+                return batch;
+            }
+        };
+        Service &service = this->service();
+        Stream<std::vector<T>> out(service);
+        auto state = std::make_shared<Window>(out);
+        // The Service is called outside the lock: the timer function takes it, also when the
+        // Service stops.
+        attach(Subscriber{ [state, &service, windowMs](const T &value) {
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                state->values_.push_back(value);
+                if (state->armed_) return;
+                state->armed_ = true;
+                generation = state->generation_;
+            }
+            std::weak_ptr<Window> weak = state;
+            Service::TimerId timer = service.setTimer(windowMs, [weak, generation](bool) {
+                std::shared_ptr<Window> state = weak.lock();
+                if (!state) return;
+                std::vector<T> batch;
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex_);
+                    if (state->generation_ != generation) return;
+                    batch = state->take();
+                }
+                if (!batch.empty()) state->out_.push(batch);
+            });
+            bool current;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                current = (state->generation_ == generation);
+                if (current) state->timer_ = timer;
+            }
+            if (!current) service.cancelTimer(timer);
+        }, [state, &service](const any *error) {
+            std::vector<T> batch;
+            std::optional<Service::TimerId> timer;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                timer.swap(state->timer_);
+                batch = state->take();
+            }
+            if (timer) service.cancelTimer(*timer);
+            if (error != nullptr) {
+                state->out_.reject(*error);
+                return;
+            }
+            if (!batch.empty()) state->out_.push(batch);
+            state->out_.close();
+        } });
+        return out;
+    }
+    // Leading-edge throttle: passes a value, then drops the ones arriving in the next intervalMs.
+    Stream<T> throttle(uint64_t intervalMs) const {
+        struct Throttle {
+            std::mutex        mutex_;
+            Clock::time_point until_;
+        };
+        Stream<T> out(service());
+        auto state = std::make_shared<Throttle>();
+        attach(Subscriber{ [out, state, intervalMs](const T &value) {
+            Clock::time_point now = Clock::now();
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                if (now < state->until_) return;
+                state->until_ = now + std::chrono::milliseconds(intervalMs);
+            }
+            out.push(value);
+        }, forwardEnd(out) });
+        return out;
+    }
+    // Emits the latest value once no new value has arrived for quietMs. Each value re-arms a
+    // single Service timer; a pending value is emitted on close().
+    Stream<T> debounce(uint64_t quietMs) const {
+        struct Debounce {
+            explicit Debounce(const Stream<T> &out)
+                : out_(out)
+                , generation_(0) {
+            }
+            std::mutex                      mutex_;
+            Stream<T>                       out_;
+            std::optional<T>                latest_;
+            std::optional<Service::TimerId> timer_;
+            uint64_t                        generation_; // bumped per value, so a stale timer does nothing
+        };
+        Service &service = this->service();
+        Stream<T> out(service);
+        auto state = std::make_shared<Debounce>(out);
+        // As in window(), the Service is called outside the lock.
+        attach(Subscriber{ [state, &service, quietMs](const T &value) {
+            uint64_t generation;
+            std::optional<Service::TimerId> stale;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                stale.swap(state->timer_);
+                state->latest_ = value;
+                generation = ++state->generation_;
+            }
+            if (stale) service.cancelTimer(*stale);
+            std::weak_ptr<Debounce> weak = state;
+            Service::TimerId timer = service.setTimer(quietMs, [weak, generation](bool) {
+                std::shared_ptr<Debounce> state = weak.lock();
+                if (!state) return;
+                std::optional<T> latest;
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex_);
+                    if (state->generation_ != generation) return;
+                    state->timer_.reset();
+                    latest.swap(state->latest_);
+                }
+                if (latest) state->out_.push(*latest);
+            });
+            bool current;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                current = (state->generation_ == generation && state->latest_);
+                if (current) state->timer_ = timer;
+            }
+            if (!current) service.cancelTimer(timer);
+        }, [state, &service](const any *error) {
+            std::optional<T> latest;
+            std::optional<Service::TimerId> timer;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                timer.swap(state->timer_);
+                ++state->generation_;
+                latest.swap(state->latest_);
+            }
+            if (timer) service.cancelTimer(*timer);
+            if (error != nullptr) {
+                state->out_.reject(*error);
+                return;
+            }
+            if (latest) state->out_.push(*latest);
+            state->out_.close();
+        } });
+        return out;
+    }
+
+    // Resolves with the first value pushed from now on, and detaches from the stream. Rejects
+    // with the stream's error, or with "stream closed without values" if it closes first.
+    // The promise does not keep the stream alive.
+    Promise first() const {
+        return newPromise([this](Defer &defer) {
+            auto done = std::make_shared<std::atomic<bool>>(false);
+            std::weak_ptr<State> weak = state_;
+            SubscriptionId id = state_->nextId_++; // known before a push() can reach the subscriber
+            attach(Subscriber{ [defer, done, weak, id](const T &value) {
+                if (done->exchange(true)) return;
+                detach(weak.lock(), id);
+                defer.resolve(value);
+            }, [defer, done](const any *error) {
+                if (done->exchange(true)) return;
+                if (error != nullptr)
+                    defer.reject(*error);
+                else
+                    defer.reject(std::runtime_error("stream closed without values"));
+            }, id });
+        });
+    }
+    // Resolves with the last value once the stream closes. Rejects like first().
+    Promise last() const {
+        struct Last {
+            std::mutex       mutex_;
+            std::optional<T> value_;
+        };
+        return newPromise([this](Defer &defer) {
+            auto last = std::make_shared<Last>();
+            attach(Subscriber{ [last](const T &value) {
+                std::lock_guard<std::mutex> lock(last->mutex_);
+                last->value_ = value;
+            }, [defer, last](const any *error) {
+                if (error != nullptr) {
+                    defer.reject(*error);
+                    return;
+                }
+                std::optional<T> value;
+                {
+                    std::lock_guard<std::mutex> lock(last->mutex_);
+                    value.swap(last->value_);
+                }
+                if (value)
+                    defer.resolve(*value);
+                else
+                    defer.reject(std::runtime_error("stream closed without values"));
+            } });
+        });
+    }
+
+private:
+    SubscriptionId attach(Subscriber subscriber) const {
+        bool failed;
+        any error;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            if (!state_->ended_) {
+                if (subscriber.id_ == 0) subscriber.id_ = state_->nextId_++;
+                SubscriptionId id = subscriber.id_;
+                auto subscribers = std::make_shared<Subscribers>(*state_->subscribers_);
+                subscribers->push_back(std::move(subscriber));
+                state_->subscribers_ = std::move(subscribers);
+                return id;
+            }
+            failed = state_->failed_;
+            error = state_->error_;
+        }
+        subscriber.end_(failed ? &error : nullptr);
+        return 0;
+    }
+    static void detach(const std::shared_ptr<State> &state, SubscriptionId id) {
+        if (!state) return;
+        std::shared_ptr<const Subscribers> previous; // released after the lock, with the subscriber
+        std::lock_guard<std::mutex> lock(state->mutex_);
+        if (state->ended_) return;
+        auto subscribers = std::make_shared<Subscribers>();
+        subscribers->reserve(state->subscribers_->size());
+        for (const Subscriber &subscriber : *state->subscribers_) {
+            if (subscriber.id_ != id) subscribers->push_back(subscriber);
+        }
+        if (subscribers->size() == state->subscribers_->size()) return;
+        previous = std::move(state->subscribers_);
+        state->subscribers_ = std::move(subscribers);
+    }
+    void end(const any *reason) const {
+        std::shared_ptr<const Subscribers> subscribers;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            if (state_->ended_) return;
+            state_->ended_ = true;
+            if (reason != nullptr) {
+                state_->failed_ = true;
+                state_->error_ = *reason;
+            }
+            // Dropping the subscribers releases the operators and streams fed by this one.
+            subscribers.swap(state_->subscribers_);
+        }
+        for (const Subscriber &subscriber : *subscribers)
+            subscriber.end_(reason);
+    }
+    template<typename U>
+    static std::function<void(const any *error)> forwardEnd(const Stream<U> &out) {
+        return [out](const any *error) {
+            if (error != nullptr)
+                out.reject(*error);
+            else
+                out.close();
+        };
+    }
+
+    std::shared_ptr<State> state_;
+};
+}
+#endif
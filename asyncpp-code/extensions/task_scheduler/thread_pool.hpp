@@ -0,0 +1,66 @@
+#pragma once
+#ifndef INC_THREAD_POOL_HPP_
+#define INC_THREAD_POOL_HPP_
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "async-promise/promise.hpp"
+// Fixed-size worker pool with one shared FIFO queue. It is a promise::Executor, so it can be
+// passed to Promise::then_on() or setExecutor(). The destructor runs what is queued, then joins.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency())
+        : stop_(false) {
+        if (threads == 0) threads = 1;
+        workers_.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+            workers_.emplace_back([this]() { work(); });
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        for (std::thread &worker : workers_)
+            worker.join();
+    }
+
+    void execute(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        cond_.notify_one();
+    }
+    size_t size() const {
+        return workers_.size();
+    }
+
+private:
+    void work() {
+        promise::ExecutorScope scope(*this);
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cond_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) return; // stopped and drained
+            std::function<void()> task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    std::mutex                        mutex_;
+    std::condition_variable           cond_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread>          workers_;
+    bool                              stop_;
+};
+#endif
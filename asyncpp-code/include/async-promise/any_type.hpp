@@ -1,6 +1,7 @@
 #pragma once
 #ifndef INC_PM_ANY_HPP_
 #define INC_PM_ANY_HPP_
+#include <mutex>
 #include <vector>
 #include <exception>
 #include <utility>
@@ -8,6 +9,7 @@
 #include <tuple>
 #include "extensions.hpp"
 #include "call_traits.hpp"
+#include "debug_alloc.hpp"
 namespace promise {
 class any;
 template<typename ValueType>
@@ -83,11 +85,24 @@ public:
     type_index type() const {
         return content ? content->type() : type_id<void>();
     }
+    // Throws the held value as its own type if a typed reject() was made with that type, else
+    // throws this any; a held std::exception_ptr is rethrown.
+    [[noreturn]] void rethrow() const;
 public:
     class placeholder {
     public:
         virtual ~placeholder() {
         }
+#ifdef PM_DEBUG
+        static void *operator new(size_t size) {
+            DebugAlloc::onAlloc(AllocKind::kAny, size);
+            return ::operator new(size);
+        }
+        static void operator delete(void *p, size_t size) {
+            DebugAlloc::onFree(AllocKind::kAny, size);
+            ::operator delete(p);
+        }
+#endif
     public:
         virtual type_index type() const = 0;
         virtual placeholder *clone() const = 0;
@@ -246,6 +261,54 @@ inline any any_call(const FUNC &func, const any &arg) {
     }
     return any_call_with_ret_t<typename call_traits<FUNC>::result_type, nocvr_argument_type, func_t>::call(stdFunc, arg);
 }
+namespace detail {
+using Rethrower = void (*)(const any &value);
+struct RethrowTable {
+    std::mutex                                    mutex_;
+    std::vector<std::pair<type_index, Rethrower>> entries_;
+};
+inline RethrowTable &rethrowTable() {
+    static RethrowTable table;
+    return table;
+}
+template<typename T>
+[[noreturn]] void rethrowAs(const any &value) {
+    throw any_cast<const T &>(value);
+}
+template<typename T>
+inline void addRethrower() {
+    static const bool added = []() {
+        RethrowTable &table = rethrowTable();
+        std::lock_guard<std::mutex> lock(table.mutex_);
+        table.entries_.emplace_back(type_id<T>(), &rethrowAs<T>);
+        return true;
+    }();
+    (void)added;
+}
+// Called by the typed reject()s: one value is thrown as its own type, several as the
+// std::vector<any> holding them.
+template<typename ...ARGS>
+inline void addRethrowers() {
+    if constexpr (sizeof...(ARGS) == 1)
+        addRethrower<std::decay_t<ARGS>...>();
+    else if constexpr (sizeof...(ARGS) > 1)
+        addRethrower<std::vector<any>>();
+}
+inline Rethrower findRethrower(type_index type) {
+    RethrowTable &table = rethrowTable();
+    std::lock_guard<std::mutex> lock(table.mutex_);
+    for (const auto &entry : table.entries_)
+        if (entry.first == type) return entry.second;
+    return nullptr;
+}
+}
+inline void any::rethrow() const {
+    if (type() == type_id<std::exception_ptr>())
+        std::rethrow_exception(any_cast<std::exception_ptr>(*this));
+    if (detail::Rethrower rethrower = detail::findRethrower(type()))
+        rethrower(*this);
+    throw *this;
+}
 using pm_any = any;
 }
 #endif
\ No newline at end of file
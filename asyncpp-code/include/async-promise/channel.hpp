@@ -0,0 +1,263 @@
+#pragma once
+#ifndef INC_PROMISE_CHANNEL_HPP_
+#define INC_PROMISE_CHANNEL_HPP_
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "promise.hpp"
+namespace promise {
+// Fixed size FIFO on one allocation, used as the buffer of Channel.
+template<typename T>
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity)
+        : slots_(capacity)
+        , head_(0)
+        , size_(0) {
+    }
+    size_t size() const {
+        return size_;
+    }
+    size_t capacity() const {
+        return slots_.size();
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    bool full() const {
+        return size_ == slots_.size();
+    }
+    void push(T &&value) {
+        slots_[(head_ + size_) % slots_.size()].emplace(std::move(value));
+        ++size_;
+    }
+    T pop() {
+        std::optional<T> &slot = slots_[head_];
+        T value = std::move(*slot);
+        slot.reset();
+        head_ = (head_ + 1) % slots_.size();
+        --size_;
+        return value;
+    }
+private:
+    std::vector<std::optional<T>> slots_;
+    size_t head_;
+    size_t size_;
+};
+
+// Bounded multi-producer/multi-consumer channel.
+// send() resolves once the value is buffered or handed to a receiver, so a producer that
+// chains on it is held back while the buffer is full. receive() resolves with the next
+// value; receiveMany(n) resolves with a std::vector<T> of 1..n values.
+// After close(), pending sends are rejected and receives drain the buffer, then reject.
+// Copies share the same channel.
+template<typename T>
+class Channel {
+    struct Sender {
+        T     value_;
+        Defer defer_;
+    };
+    struct Receiver {
+        Defer  defer_;
+        size_t max_; // 0 for receive(), n for receiveMany(n)
+    };
+    struct State {
+        explicit State(size_t capacity)
+            : buffer_(capacity)
+            , closed_(false) {
+        }
+        std::mutex           mutex_;
+        RingBuffer<T>        buffer_;
+        std::deque<Sender>   senders_;
+        std::deque<Receiver> receivers_;
+        bool                 closed_;
+    };
+public:
+    // A capacity of 0 makes an unbuffered channel: send() waits for a receiver.
+    explicit Channel(size_t capacity)
+        : state_(std::make_shared<State>(capacity)) {
+    }
+
+    // Promises are created and settled with the channel lock released: their continuations
+    // may call back into the channel.
+    Promise send(T value) {
+        std::optional<Defer> defer; // for the promise of a send that has to wait
+        Promise blocked;
+        while (true) {
+            std::optional<Receiver> receiver;
+            bool closed = false;
+            bool block = false;
+            bool queued = false;
+            {
+                std::lock_guard<std::mutex> lock(state_->mutex_);
+                if (state_->closed_) {
+                    closed = true;
+                }
+                else if (!state_->receivers_.empty()) {
+                    receiver.emplace(std::move(state_->receivers_.front()));
+                    state_->receivers_.pop_front();
+                }
+                else if (!state_->buffer_.full()) {
+                    state_->buffer_.push(std::move(value));
+                }
+                else if (defer) {
+                    state_->senders_.push_back(Sender{ std::move(value), *defer });
+                    queued = true;
+                }
+                else {
+                    block = true;
+                }
+            }
+            if (queued)
+                return blocked;
+            if (block) {
+                blocked = newPromise([&defer](Defer &pending) {
+                    defer = pending;
+                });
+                continue;
+            }
+            if (receiver)
+                deliver(*receiver, std::move(value));
+            if (!defer)
+                return closed ? reject(std::runtime_error("channel closed")) : resolve();
+            if (closed)
+                defer->reject(std::runtime_error("channel closed"));
+            else
+                defer->resolve();
+            return blocked;
+        }
+    }
+
+    Promise receive() {
+        return receiveUpTo(1, 0);
+    }
+
+    Promise receiveMany(size_t n) {
+        if (n == 0)
+            return resolve(std::vector<T>());
+        return receiveUpTo(n, n);
+    }
+
+    void close() {
+        DeferBatch senders;
+        DeferBatch receivers;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            if (state_->closed_) return;
+            state_->closed_ = true;
+            for (const Sender &sender : state_->senders_)
+                senders.add(sender.defer_);
+            for (const Receiver &receiver : state_->receivers_)
+                receivers.add(receiver.defer_);
+            state_->senders_.clear();
+            state_->receivers_.clear();
+        }
+        senders.reject(std::runtime_error("channel closed"));
+        receivers.reject(std::runtime_error("channel closed"));
+    }
+
+    // Number of buffered values, not counting blocked senders.
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->buffer_.size();
+    }
+    size_t capacity() const {
+        return state_->buffer_.capacity();
+    }
+    bool isClosed() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->closed_;
+    }
+
+private:
+    // Moves up to n values out of the buffer, refilling it from blocked senders (or, for an
+    // unbuffered channel, taking from them directly). Called with the lock held.
+    void take(size_t n, std::vector<T> &values, DeferBatch &accepted) {
+        values.reserve(std::min(n, state_->buffer_.size() + state_->senders_.size()));
+        while (values.size() < n) {
+            if (!state_->buffer_.empty()) {
+                values.push_back(state_->buffer_.pop());
+                if (!state_->senders_.empty()) {
+                    state_->buffer_.push(std::move(state_->senders_.front().value_));
+                    accepted.add(state_->senders_.front().defer_);
+                    state_->senders_.pop_front();
+                }
+            }
+            else if (!state_->senders_.empty()) {
+                values.push_back(std::move(state_->senders_.front().value_));
+                accepted.add(state_->senders_.front().defer_);
+                state_->senders_.pop_front();
+            }
+            else {
+                break;
+            }
+        }
+    }
+
+    // receive() for max 0, receiveMany(n) otherwise.
+    Promise receiveUpTo(size_t n, size_t max) {
+        std::optional<Defer> defer; // for the promise of a receive that has to wait
+        Promise blocked;
+        while (true) {
+            std::vector<T> values;
+            DeferBatch accepted;
+            bool closed = false;
+            bool queued = false;
+            {
+                std::lock_guard<std::mutex> lock(state_->mutex_);
+                take(n, values, accepted);
+                if (values.empty()) {
+                    if (state_->closed_) {
+                        closed = true;
+                    }
+                    else if (defer) {
+                        state_->receivers_.push_back(Receiver{ *defer, max });
+                        queued = true;
+                    }
+                }
+            }
+            if (queued)
+                return blocked;
+            if (values.empty() && !closed) {
+                blocked = newPromise([&defer](Defer &pending) {
+                    defer = pending;
+                });
+                continue;
+            }
+            accepted.resolve();
+            if (closed) {
+                if (!defer) return reject(std::runtime_error("channel closed"));
+                defer->reject(std::runtime_error("channel closed"));
+            }
+            else if (max == 0) {
+                if (!defer) return resolve(std::move(values.front()));
+                defer->resolve(std::move(values.front()));
+            }
+            else {
+                if (!defer) return resolve(std::move(values));
+                defer->resolve(std::move(values));
+            }
+            return blocked;
+        }
+    }
+
+    static void deliver(const Receiver &receiver, T &&value) {
+        if (receiver.max_ == 0) {
+            receiver.defer_.resolve(std::move(value));
+        }
+        else {
+            std::vector<T> values;
+            values.push_back(std::move(value));
+            receiver.defer_.resolve(std::move(values));
+        }
+    }
+
+    std::shared_ptr<State> state_;
+};
+}
+#endif
@@ -0,0 +1,247 @@
+#pragma once
+#ifndef INC_PROMISE_COMBINATORS_HPP_
+#define INC_PROMISE_COMBINATORS_HPP_
+#include <atomic>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "promise.hpp"
+#include "channel.hpp"
+namespace promise {
+namespace detail {
+// Shared state of mapLimit()/forEachLimit(). The range is kept alive here, and results go to
+// a vector sized up front. pump() starts work while fewer than limit_ calls are in flight;
+// a call that completes synchronously inside pump() only updates the counters, so long runs
+// of synchronous work loop instead of recursing.
+template<typename RANGE, typename FUNC>
+struct MapLimitState : std::enable_shared_from_this<MapLimitState<RANGE, FUNC>> {
+    using iterator = decltype(std::begin(std::declval<std::decay_t<RANGE> &>()));
+    MapLimitState(RANGE &&range, size_t limit, FUNC &&func, bool keepResults)
+        : range_(std::forward<RANGE>(range))
+        , func_(std::forward<FUNC>(func))
+        , limit_(limit == 0 ? 1 : limit)
+        , next_(std::begin(range_))
+        , index_(0)
+        , inFlight_(0)
+        , done_(0)
+        , size_((size_t)std::distance(std::begin(range_), std::end(range_)))
+        , pumping_(false)
+        , failed_(false)
+        , keepResults_(keepResults) {
+        if (keepResults_)
+            results_.resize(size_);
+    }
+
+    void pump() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (pumping_) return;
+        pumping_ = true;
+        while (!failed_ && inFlight_ < limit_ && next_ != std::end(range_)) {
+            iterator current = next_++;
+            size_t index = index_++;
+            ++inFlight_;
+            lock.unlock();
+            start(current, index);
+            lock.lock();
+        }
+        pumping_ = false;
+    }
+
+    void start(iterator current, size_t index) {
+        auto self = this->shared_from_this();
+        promise::resolve().then([self, current]() {
+            return self->func_(*current);
+        }).then([self, index](const any &arg) {
+            self->complete(index, &arg);
+        }, [self](const any &arg) {
+            self->fail(arg);
+        });
+    }
+
+    void complete(size_t index, const any *arg) {
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (keepResults_)
+                results_[index] = *arg;
+            --inFlight_;
+            finished = (++done_ == size_ && !failed_);
+        }
+        if (finished) {
+            if (keepResults_)
+                defer_->resolve(std::move(results_));
+            else
+                defer_->resolve();
+            return;
+        }
+        pump();
+    }
+
+    void fail(const any &arg) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --inFlight_;
+            ++done_;
+            if (failed_) return;
+            failed_ = true;
+        }
+        defer_->reject(arg);
+    }
+
+    std::mutex             mutex_;
+    std::decay_t<RANGE>    range_;
+    std::decay_t<FUNC>     func_;
+    const size_t           limit_;
+    iterator               next_;
+    size_t                 index_;
+    size_t                 inFlight_;
+    size_t                 done_;
+    const size_t           size_;
+    bool                   pumping_;
+    bool                   failed_;
+    const bool             keepResults_;
+    std::vector<any>       results_;
+    std::unique_ptr<Defer> defer_;
+};
+template<typename RANGE, typename FUNC>
+inline Promise mapLimit(RANGE &&range, size_t limit, FUNC &&func, bool keepResults) {
+    using State = MapLimitState<RANGE, FUNC>;
+    auto state = std::make_shared<State>(std::forward<RANGE>(range), limit, std::forward<FUNC>(func), keepResults);
+    if (state->size_ == 0)
+        return keepResults ? resolve(std::vector<any>()) : resolve();
+    Promise promise = newPromise([&state](Defer &defer) {
+        state->defer_.reset(new Defer(defer));
+    });
+    state->pump();
+    return promise;
+}
+}
+
+// Calls func(item) for every item of range with at most `limit` calls in flight, starting the
+// next one as each completes. func may return a value or a Promise. Resolves with a
+// std::vector<any> of the results in range order (read it like the result of all()); rejects
+// with the first failure and starts no more calls after it.
+// The range is moved or copied into the operation, so temporaries are fine.
+template<typename RANGE, typename FUNC>
+inline Promise mapLimit(RANGE &&range, size_t limit, FUNC &&func) {
+    return detail::mapLimit(std::forward<RANGE>(range), limit, std::forward<FUNC>(func), true);
+}
+// Like mapLimit(), but keeps no results and resolves with no value.
+template<typename RANGE, typename FUNC>
+inline Promise forEachLimit(RANGE &&range, size_t limit, FUNC &&func) {
+    return detail::mapLimit(std::forward<RANGE>(range), limit, std::forward<FUNC>(func), false);
+}
+
+// One settled input of asCompleted(): its position in the input list and its outcome.
+struct Completion {
+    size_t    index_;
+    TaskState state_;
+    any       value_;
+};
+// Delivers every input as it settles, in completion order, through a channel with a slot per
+// input that is closed after the last one. Inputs settling after the consumer closed it are dropped.
+inline Channel<Completion> asCompleted(const std::list<Promise> &promise_list) {
+    Channel<Completion> channel(promise_list.size());
+    if (promise_list.empty()) {
+        channel.close();
+        return channel;
+    }
+    auto remaining = std::make_shared<std::atomic<size_t>>(promise_list.size());
+    size_t index = 0;
+    for (Promise promise : promise_list) {
+        const size_t current_index = index++;
+        promise.then([channel, remaining, current_index](const any &arg) mutable {
+            channel.send(Completion{ current_index, TaskState::kResolved, arg }).fail([](const any &) {});
+            if (--(*remaining) == 0) channel.close();
+            return KeepOutcome();
+        }, [channel, remaining, current_index](const any &arg) mutable {
+            channel.send(Completion{ current_index, TaskState::kRejected, arg }).fail([](const any &) {});
+            if (--(*remaining) == 0) channel.close();
+            return KeepOutcome();
+        });
+    }
+    return channel;
+}
+template<typename PROMISE_LIST>
+inline auto asCompleted(const PROMISE_LIST &promise_list) -> std::enable_if_t<is_iterable<PROMISE_LIST>::value && !std::is_same_v<PROMISE_LIST, std::list<Promise>>, Channel<Completion>> {
+    std::list<Promise> copy_list = { std::begin(promise_list), std::end(promise_list) };
+    return asCompleted(copy_list);
+}
+
+// Resolves with the first k results (a std::vector<any> in completion order) as soon as k
+// inputs resolved, or rejects with the last error once k successes are out of reach.
+// Either way the inputs still pending are cancelled by rejecting them.
+inline Promise quorum(size_t k, const std::list<Promise> &promise_list) {
+    if (k == 0)
+        return resolve(std::vector<any>());
+    if (k > promise_list.size())
+        return reject(std::runtime_error("quorum larger than the number of promises"));
+    struct State {
+        std::mutex           mutex_;
+        std::vector<Promise> pending_; // cleared once the quorum is decided
+        std::vector<bool>    settled_;
+        std::vector<any>     results_;
+        size_t               failures_ = 0;
+        bool                 done_ = false;
+    };
+    auto state = std::make_shared<State>();
+    state->pending_.assign(promise_list.begin(), promise_list.end());
+    state->settled_.resize(promise_list.size());
+    state->results_.reserve(k);
+    const size_t maxFailures = promise_list.size() - k;
+    // Called with the lock held; returns the inputs that are still pending.
+    auto decide = [](State &state) {
+        std::vector<Promise> rest;
+        for (size_t i = 0; i < state.pending_.size(); ++i) {
+            if (!state.settled_[i]) rest.push_back(state.pending_[i]);
+        }
+        state.pending_.clear();
+        state.done_ = true;
+        return rest;
+    };
+    return newPromise([&](Defer &defer) {
+        size_t index = 0;
+        for (Promise promise : promise_list) {
+            const size_t current_index = index++;
+            promise.then([state, defer, k, current_index, decide](const any &arg) {
+                std::vector<Promise> rest;
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex_);
+                    if (state->done_) return KeepOutcome();
+                    state->settled_[current_index] = true;
+                    state->results_.push_back(arg);
+                    if (state->results_.size() < k) return KeepOutcome();
+                    rest = decide(*state);
+                }
+                defer.resolve(state->results_);
+                for (const Promise &promise : rest)
+                    promise.reject(std::runtime_error("cancelled by quorum"));
+                return KeepOutcome();
+            }, [state, defer, maxFailures, current_index, decide](const any &arg) {
+                std::vector<Promise> rest;
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex_);
+                    if (state->done_) return KeepOutcome();
+                    state->settled_[current_index] = true;
+                    if (++state->failures_ <= maxFailures) return KeepOutcome();
+                    rest = decide(*state);
+                }
+                defer.reject(arg);
+                for (const Promise &promise : rest)
+                    promise.reject(std::runtime_error("cancelled by quorum"));
+                return KeepOutcome();
+            });
+        }
+    });
+}
+template<typename PROMISE_LIST>
+inline auto quorum(size_t k, const PROMISE_LIST &promise_list) -> std::enable_if_t<is_iterable<PROMISE_LIST>::value && !std::is_same_v<PROMISE_LIST, std::list<Promise>>, Promise> {
+    std::list<Promise> copy_list = { std::begin(promise_list), std::end(promise_list) };
+    return quorum(k, copy_list);
+}
+}
+#endif
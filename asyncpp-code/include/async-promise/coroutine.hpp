@@ -0,0 +1,187 @@
+#pragma once
+#ifndef INC_PROMISE_COROUTINE_HPP_
+#define INC_PROMISE_COROUTINE_HPP_
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "promise.hpp"
+// co_await on a Promise returns its value as an any or throws its rejection. A coroutine returning
+// CoPromise settles it with co_return or an escaping exception. AsyncGenerator<T> co_yields values
+// to a consumer that co_awaits next().
+namespace promise {
+class PromiseAwaiter {
+public:
+    explicit PromiseAwaiter(Promise promise)
+        : promise_(std::move(promise))
+        , rejected_(false)
+        , ready_(false) {
+    }
+    bool await_ready() const noexcept {
+        return false;
+    }
+    // Whichever of await_suspend() and the handler comes second resumes the coroutine, after
+    // the handler has released the promise (see afterHandler()).
+    bool await_suspend(std::coroutine_handle<> handle) {
+        PromiseAwaiter *self = this;
+        promise_.then([self, handle](const any &arg) {
+            self->value_ = arg;
+            if (self->ready_.exchange(true)) afterHandler([handle]() { handle.resume(); });
+            return KeepOutcome();
+        }, [self, handle](const any &arg) {
+            self->value_ = arg;
+            self->rejected_ = true;
+            if (self->ready_.exchange(true)) afterHandler([handle]() { handle.resume(); });
+            return KeepOutcome();
+        });
+        return !ready_.exchange(true);
+    }
+    any await_resume() {
+        if (rejected_) value_.rethrow();
+        return std::move(value_);
+    }
+private:
+    Promise           promise_;
+    any               value_;
+    bool              rejected_;
+    std::atomic<bool> ready_;
+};
+inline PromiseAwaiter operator co_await(Promise promise) {
+    return PromiseAwaiter(std::move(promise));
+}
+
+namespace detail {
+// Coroutine state of a coroutine that returns CoPromise. It starts eagerly, like newPromise().
+struct PromiseCoroutine {
+    std::optional<Defer> defer_;
+    Promise get_return_object() {
+        return newPromise([this](Defer &defer) {
+            defer_.emplace(defer);
+        });
+    }
+    std::suspend_never initial_suspend() noexcept {
+        return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+        return {};
+    }
+    void return_value(const any &value) {
+        defer_->resolve(value);
+    }
+    void unhandled_exception() {
+        defer_->reject(any(std::current_exception()));
+    }
+};
+}
+// Return type of a Promise coroutine; plain Promise-returning functions stay ordinary functions.
+class CoPromise : public Promise {
+public:
+    using promise_type = detail::PromiseCoroutine;
+    CoPromise(Promise promise)
+        : Promise(std::move(promise)) {
+    }
+};
+
+// Lazy sequence of T produced by a coroutine with co_yield; the producer runs only while the
+// consumer waits in next(), and may co_await Promises between yields. Move-only; destroying it
+// destroys the producer, which must not be suspended in a co_await.
+template<typename T>
+class AsyncGenerator {
+public:
+    struct promise_type {
+        const T                *current_ = nullptr;
+        std::coroutine_handle<> consumer_;
+        std::exception_ptr      error_;
+
+        AsyncGenerator get_return_object() {
+            return AsyncGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        struct Transfer {
+            bool await_ready() const noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                return handle.promise().consumer_;
+            }
+            void await_resume() const noexcept {
+            }
+        };
+        // value outlives the suspension: it is a temporary of the co_yield expression or an lvalue.
+        Transfer yield_value(const T &value) noexcept {
+            current_ = &value;
+            return {};
+        }
+        Transfer final_suspend() noexcept {
+            current_ = nullptr;
+            return {};
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            error_ = std::current_exception();
+        }
+    };
+    using Handle = std::coroutine_handle<promise_type>;
+
+    // Resumes the producer; completes with the next value, std::nullopt when the producer has
+    // finished, or rethrows what escaped from it.
+    class NextAwaiter {
+    public:
+        explicit NextAwaiter(Handle handle)
+            : handle_(handle) {
+        }
+        bool await_ready() const noexcept {
+            return !handle_ || handle_.done();
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept {
+            handle_.promise().consumer_ = consumer;
+            return handle_;
+        }
+        std::optional<T> await_resume() {
+            if (!handle_) return std::nullopt;
+            promise_type &state = handle_.promise();
+            if (state.error_) {
+                std::exception_ptr error = std::move(state.error_);
+                state.error_ = nullptr;
+                std::rethrow_exception(error);
+            }
+            if (handle_.done()) return std::nullopt;
+            return std::optional<T>(*state.current_);
+        }
+    private:
+        Handle handle_;
+    };
+
+    AsyncGenerator(AsyncGenerator &&other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)) {
+    }
+    AsyncGenerator &operator=(AsyncGenerator &&other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    AsyncGenerator(const AsyncGenerator &) = delete;
+    AsyncGenerator &operator=(const AsyncGenerator &) = delete;
+    ~AsyncGenerator() {
+        if (handle_) handle_.destroy();
+    }
+
+    // Must not be called again before the previous next() has completed.
+    NextAwaiter next() {
+        return NextAwaiter(handle_);
+    }
+private:
+    explicit AsyncGenerator(Handle handle)
+        : handle_(handle) {
+    }
+    Handle handle_;
+};
+}
+#endif
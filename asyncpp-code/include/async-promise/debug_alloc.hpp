@@ -0,0 +1,155 @@
+#pragma once
+#ifndef INC_PROMISE_DEBUG_ALLOC_HPP_
+#define INC_PROMISE_DEBUG_ALLOC_HPP_
+#include <list>
+#include <memory>
+#include <new>
+#include <cstddef>
+#ifdef PM_DEBUG
+#include <atomic>
+#endif
+namespace promise {
+enum class AllocKind {
+    kAny,
+    kTask,
+    kPromiseHolder,
+    kSharedPromise,
+    kListNode,
+    kCount
+};
+#ifdef PM_DEBUG
+// Allocation accounting, enabled by building with PM_DEBUG (cmake -DPROMISE_DEBUG_ALLOC=ON).
+// Counts allocations, frees and bytes per internal object kind, globally and per thread.
+struct AllocStats {
+    static constexpr size_t kKinds = (size_t)AllocKind::kCount;
+    size_t allocations_[kKinds]   = {};
+    size_t deallocations_[kKinds] = {};
+    size_t bytes_[kKinds]         = {};
+    size_t freedBytes_[kKinds]    = {};
+
+    size_t allocations() const {
+        size_t sum = 0;
+        for (size_t i = 0; i < kKinds; ++i) sum += allocations_[i];
+        return sum;
+    }
+    size_t bytes() const {
+        size_t sum = 0;
+        for (size_t i = 0; i < kKinds; ++i) sum += bytes_[i];
+        return sum;
+    }
+    // Bytes allocated minus bytes freed on this thread (or globally); negative for a thread
+    // that freed more than it allocated, e.g. promises created on another thread.
+    ptrdiff_t liveBytes() const {
+        ptrdiff_t sum = 0;
+        for (size_t i = 0; i < kKinds; ++i) sum += (ptrdiff_t)bytes_[i] - (ptrdiff_t)freedBytes_[i];
+        return sum;
+    }
+    size_t allocations(AllocKind kind) const {
+        return allocations_[(size_t)kind];
+    }
+    size_t bytes(AllocKind kind) const {
+        return bytes_[(size_t)kind];
+    }
+    AllocStats operator-(const AllocStats &other) const {
+        AllocStats diff;
+        for (size_t i = 0; i < kKinds; ++i) {
+            diff.allocations_[i] = allocations_[i] - other.allocations_[i];
+            diff.deallocations_[i] = deallocations_[i] - other.deallocations_[i];
+            diff.bytes_[i] = bytes_[i] - other.bytes_[i];
+            diff.freedBytes_[i] = freedBytes_[i] - other.freedBytes_[i];
+        }
+        return diff;
+    }
+};
+struct DebugAlloc {
+    struct GlobalCounters {
+        std::atomic<size_t> allocations_[AllocStats::kKinds];
+        std::atomic<size_t> deallocations_[AllocStats::kKinds];
+        std::atomic<size_t> bytes_[AllocStats::kKinds];
+        std::atomic<size_t> freedBytes_[AllocStats::kKinds];
+        std::atomic<size_t> liveBytes_;
+    };
+    static inline GlobalCounters &globalCounters() {
+        static GlobalCounters counters{};
+        return counters;
+    }
+    static inline AllocStats &threadCounters() {
+        static thread_local AllocStats counters;
+        return counters;
+    }
+    static inline void onAlloc(AllocKind kind, size_t bytes) {
+        GlobalCounters &global = globalCounters();
+        global.allocations_[(size_t)kind].fetch_add(1, std::memory_order_relaxed);
+        global.bytes_[(size_t)kind].fetch_add(bytes, std::memory_order_relaxed);
+        global.liveBytes_.fetch_add(bytes, std::memory_order_relaxed);
+        AllocStats &local = threadCounters();
+        ++local.allocations_[(size_t)kind];
+        local.bytes_[(size_t)kind] += bytes;
+    }
+    static inline void onFree(AllocKind kind, size_t bytes) {
+        GlobalCounters &global = globalCounters();
+        global.deallocations_[(size_t)kind].fetch_add(1, std::memory_order_relaxed);
+        global.freedBytes_[(size_t)kind].fetch_add(bytes, std::memory_order_relaxed);
+        global.liveBytes_.fetch_sub(bytes, std::memory_order_relaxed);
+        AllocStats &local = threadCounters();
+        ++local.deallocations_[(size_t)kind];
+        local.freedBytes_[(size_t)kind] += bytes;
+    }
+    static inline AllocStats global() {
+        GlobalCounters &global = globalCounters();
+        AllocStats stats;
+        for (size_t i = 0; i < AllocStats::kKinds; ++i) {
+            stats.allocations_[i] = global.allocations_[i].load(std::memory_order_relaxed);
+            stats.deallocations_[i] = global.deallocations_[i].load(std::memory_order_relaxed);
+            stats.bytes_[i] = global.bytes_[i].load(std::memory_order_relaxed);
+            stats.freedBytes_[i] = global.freedBytes_[i].load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+    static inline AllocStats thread() {
+        return threadCounters();
+    }
+};
+template<typename T, AllocKind KIND>
+struct pm_allocator {
+    using value_type = T;
+    template<typename U>
+    struct rebind {
+        using other = pm_allocator<U, KIND>;
+    };
+    pm_allocator() = default;
+    template<typename U>
+    pm_allocator(const pm_allocator<U, KIND> &) {}
+    T *allocate(size_t n) {
+        DebugAlloc::onAlloc(KIND, n * sizeof(T));
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T *p, size_t n) {
+        DebugAlloc::onFree(KIND, n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+    template<typename U>
+    bool operator==(const pm_allocator<U, KIND> &) const { return true; }
+    template<typename U>
+    bool operator!=(const pm_allocator<U, KIND> &) const { return false; }
+};
+template<typename T>
+using pm_list = std::list<T, pm_allocator<T, AllocKind::kListNode>>;
+template<typename T, AllocKind KIND, typename ...ARGS>
+inline std::shared_ptr<T> pm_make_shared(ARGS &&...args) {
+    return std::allocate_shared<T>(pm_allocator<T, KIND>(), std::forward<ARGS>(args)...);
+}
+// Bytes currently held by all counted kinds, as used by the examples.
+inline std::atomic<size_t> *dbg_alloc_size() {
+    return &DebugAlloc::globalCounters().liveBytes_;
+}
+#else
+template<typename T>
+using pm_list = std::list<T>;
+template<typename T, AllocKind KIND, typename ...ARGS>
+inline std::shared_ptr<T> pm_make_shared(ARGS &&...args) {
+    return std::make_shared<T>(std::forward<ARGS>(args)...);
+}
+#endif
+}
+#endif
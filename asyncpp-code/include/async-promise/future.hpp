@@ -0,0 +1,113 @@
+#pragma once
+#ifndef INC_PROMISE_FUTURE_HPP_
+#define INC_PROMISE_FUTURE_HPP_
+#include <chrono>
+#include <exception>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "promise.hpp"
+// Bridges between Promise and std::future, for code outside the event loop.
+namespace promise {
+namespace detail {
+inline std::exception_ptr toExceptionPtr(const any &arg) {
+    try {
+        arg.rethrow();
+    }
+    catch (...) {
+        return std::current_exception();
+    }
+}
+template<typename T>
+inline void settleFromFuture(std::future<T> &future, const Defer &defer) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            future.get();
+            defer.resolve();
+        }
+        else {
+            defer.resolve(future.get());
+        }
+    }
+    catch (...) {
+        defer.reject(std::current_exception());
+    }
+}
+// Polls a future from the timers of a Service-like SERVICE, see fromFuture(service, future).
+template<typename T, typename SERVICE>
+struct FuturePoll {
+    SERVICE        &service_;
+    std::future<T>  future_;
+    Defer           defer_;
+    uint64_t        pollMs_;
+
+    static void arm(const std::shared_ptr<FuturePoll> &poll) {
+        poll->service_.setTimer(poll->pollMs_, [poll](bool fired) {
+            if (!fired) {
+                poll->defer_.reject(std::runtime_error("service stopped"));
+                return;
+            }
+            if (poll->future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                settleFromFuture(poll->future_, poll->defer_);
+            else
+                arm(poll);
+        });
+    }
+};
+}
+
+// A std::future that receives the outcome of promise. Consumes promise like a final then().
+template<typename T = void>
+inline std::future<T> toFuture(Promise promise) {
+    auto result = std::make_shared<std::promise<T>>();
+    std::future<T> future = result->get_future();
+    promise.then([result](const any &arg) {
+        try {
+            if constexpr (std::is_void_v<T>)
+                result->set_value();
+            else
+                result->set_value(arg.cast<T>());
+        }
+        catch (...) {
+            result->set_exception(std::current_exception());
+        }
+    }, [result](const any &arg) {
+        result->set_exception(detail::toExceptionPtr(arg));
+    });
+    return future;
+}
+
+// A Promise settled by future. A future that is already ready settles it at once; otherwise
+// one detached thread blocks in future.get() and settles it from there. That is a thread
+// (stack and creation) per pending future: for many of them, use fromFuture(service, future).
+template<typename T>
+inline Promise fromFuture(std::future<T> future) {
+    return newPromise([&](Defer &defer) {
+        if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            detail::settleFromFuture(future, defer);
+            return;
+        }
+        std::thread([defer, future = std::move(future)]() mutable {
+            detail::settleFromFuture(future, defer);
+        }).detach();
+    });
+}
+// Like fromFuture(future), but without a thread: a pending future is polled every pollMs on
+// service's timers, and the promise is settled on the service thread. SERVICE is anything
+// with Service's setTimer(ms, func(bool fired)); it rejects the promise if it stops first.
+template<typename T, typename SERVICE>
+inline Promise fromFuture(SERVICE &service, std::future<T> future, uint64_t pollMs = 1) {
+    return newPromise([&](Defer &defer) {
+        if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            detail::settleFromFuture(future, defer);
+            return;
+        }
+        detail::FuturePoll<T, SERVICE>::arm(std::make_shared<detail::FuturePoll<T, SERVICE>>(
+            detail::FuturePoll<T, SERVICE>{ service, std::move(future), defer, pollMs }));
+    });
+}
+}
+#endif
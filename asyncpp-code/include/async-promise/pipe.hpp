@@ -0,0 +1,55 @@
+#pragma once
+#ifndef INC_PROMISE_PIPE_HPP_
+#define INC_PROMISE_PIPE_HPP_
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "call_traits.hpp"
+namespace promise {
+class Promise;
+template<typename ARGS, typename ...FUNCS>
+struct pipe_t;
+// Callable that runs FUNCS in sequence, passing each result to the next stage.
+// Intermediate values stay typed; only the result of the last stage is boxed
+// into an any by then(), so the whole pipeline costs a single Task.
+template<typename ...ARGS, typename ...FUNCS>
+struct pipe_t<std::tuple<ARGS...>, FUNCS...> {
+    std::tuple<FUNCS...> funcs_;
+
+    auto operator()(ARGS ...args) const {
+        return step<0>(std::forward<ARGS>(args)...);
+    }
+private:
+    template<size_t I, typename ...T>
+    auto step(T &&...values) const {
+        using func_t = std::tuple_element_t<I, std::tuple<FUNCS...>>;
+        using result_t = std::invoke_result_t<const func_t &, T...>;
+        if constexpr (I + 1 == sizeof...(FUNCS)) {
+            return std::get<I>(funcs_)(std::forward<T>(values)...);
+        }
+        else {
+            static_assert(!std::is_same_v<std::remove_cvref_t<result_t>, Promise>,
+                "only the last stage of pipe() may return a Promise");
+            if constexpr (std::is_void_v<result_t>) {
+                std::get<I>(funcs_)(std::forward<T>(values)...);
+                return step<I + 1>();
+            }
+            else {
+                return step<I + 1>(std::get<I>(funcs_)(std::forward<T>(values)...));
+            }
+        }
+    }
+};
+// Fuses synchronous continuations into one, e.g.
+//   promise.then(pipe(parse, validate, project));
+// instead of promise.then(parse).then(validate).then(project).
+// The pipeline takes the arguments of the first stage.
+template<typename FUNC0, typename ...FUNCS>
+inline auto pipe(FUNC0 &&func0, FUNCS &&...funcs) {
+    using argument_type = typename call_traits<std::decay_t<FUNC0>>::argument_type;
+    return pipe_t<argument_type, std::decay_t<FUNC0>, std::decay_t<FUNCS>...>{
+        std::tuple<std::decay_t<FUNC0>, std::decay_t<FUNCS>...>(std::forward<FUNC0>(func0), std::forward<FUNCS>(funcs)...)
+    };
+}
+}
+#endif
@@ -34,10 +34,15 @@
 #endif
 #include <list>
 #include <vector>
+#include <atomic>
 #include <memory>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <source_location>
+#include <span>
+#include <type_traits>
 #include "any_type.hpp"
 namespace promise {
 enum class TaskState {
@@ -47,24 +52,73 @@ enum class TaskState {
 };
 struct PromiseHolder;
 struct SharedPromise;
+struct RegistryEntry;
 class Promise;
+class Defer;
+// Anything with execute(task) can run continuations: Service, ThreadPool, InlineExecutor.
+template<typename EXECUTOR>
+concept Executor = requires(EXECUTOR &executor, std::function<void()> task) {
+    executor.execute(std::move(task));
+};
+// Runs tasks right away on the calling thread.
+struct InlineExecutor {
+    void execute(std::function<void()> task) const {
+        task();
+    }
+};
+// Type-erased executor stored on a promise; id_ is the address of the executor object.
+struct PromiseExecutor {
+    std::function<void(std::function<void()> task)> execute_;
+    const void                                     *id_;
+};
+// Held by an executor's own run loop (Service::run(), ThreadPool workers): while it exists the
+// thread counts as running on executor, so a promise bound to executor that settles here
+// delivers inline instead of posting its continuations back to the same loop.
+class ExecutorScope {
+public:
+    template<Executor EXECUTOR>
+    explicit ExecutorScope(EXECUTOR &executor)
+        : ExecutorScope(static_cast<const void *>(&executor)) {
+    }
+    PROMISE_API explicit ExecutorScope(const void *id);
+    PROMISE_API ~ExecutorScope();
+    ExecutorScope(const ExecutorScope &) = delete;
+    ExecutorScope &operator=(const ExecutorScope &) = delete;
+private:
+    const void *saved_;
+};
 struct Task {
     TaskState state_;
-    std::weak_ptr<PromiseHolder> promiseHolder_;
+    std::atomic<std::weak_ptr<PromiseHolder>> promiseHolder_; // atomic: join() moves it while call() reads it
     any                          onResolved_;
     any                          onRejected_;
+    std::chrono::steady_clock::time_point deadline_; // time_point::max() for none
+};
+// Returned from a then() handler to leave the outcome of the promise as it was, so the next
+// handler gets the same value or rejection. For handlers that only observe a promise other code
+// may hold too. A rejection passed on this way counts as handled: it is not reported as uncaught
+// if no handler follows.
+struct KeepOutcome {
+};
+// Like KeepOutcome, but a rejection passed on stays unhandled: for observers such as
+// wait()/get() that do not act on it themselves.
+struct ObserveOutcome {
 };
 struct PromiseHolder {
     PROMISE_API PromiseHolder();
     PROMISE_API ~PromiseHolder();
-    std::list<std::weak_ptr<SharedPromise>> owners_;
-    std::list<std::shared_ptr<Task>>        pendingTasks_;
+    pm_list<std::weak_ptr<SharedPromise>>   owners_;
+    pm_list<std::shared_ptr<Task>>          pendingTasks_;
     TaskState                               state_;
+    bool                                    handled_;  // the rejection in value_ was kept by KeepOutcome
     any                                     value_;
     mutable std::recursive_mutex mutex_;
     std::condition_variable_any cond_;
+    RegistryEntry                           *registryEntry_;
+    std::shared_ptr<PromiseExecutor>        executor_; // where continuations run, null for inline
 
     PROMISE_API void dump() const;
+    PROMISE_API static void runLazy(const SharedPromise &sharedPromise);
     PROMISE_API static any *getUncaughtExceptionHandler();
     PROMISE_API static any *getDefaultUncaughtExceptionHandler();
     PROMISE_API static void onUncaughtException(const any &arg);
@@ -73,8 +127,17 @@ struct PromiseHolder {
 template<typename ...ARGS>
 struct is_one_any : public std::is_same<typename tuple_remove_cvref<std::tuple<ARGS...>>::type, std::tuple<any>> {
 };
+// Outcome of a promise for threads blocked in Promise::wait()/get(). state_ is the word they
+// sleep on; kSleeping tells the settling thread that a wakeup is needed.
+struct SettleWaiter {
+    enum : uint32_t { kPending, kSleeping, kResolved, kRejected };
+    std::atomic<uint32_t> state_{ kPending };
+    any                   value_;
+    std::weak_ptr<Task>   task_; // the then() that settles it
+};
 struct SharedPromise {
-    std::shared_ptr<PromiseHolder> promiseHolder_;
+    // atomic: join() moves it while other threads read it. Null until a lazyPromise() is used.
+    std::atomic<std::shared_ptr<PromiseHolder>> promiseHolder_;
     PROMISE_API void dump() const;
 #if PROMISE_MULTITHREAD
 #endif
@@ -87,6 +150,7 @@ public:
     }
     template<typename ...ARGS>
     inline std::enable_if_t<!is_one_any<ARGS...>::value> reject(ARGS &&...args) const {
+        detail::addRethrowers<ARGS...>();
         reject(any{ std::vector<any>{std::forward<ARGS>(args)...} });
     }
     PROMISE_API void resolve(const any &arg) const;
@@ -94,8 +158,11 @@ public:
     PROMISE_API Promise getPromise() const;
 private:
     friend class Promise;
-    friend PROMISE_API Promise newPromise(const std::function<void(Defer &defer)> &run);
+    friend class DeferBatch;
+    friend struct PromiseHolder;
+    friend PROMISE_API Promise newPromise(const std::function<void(Defer &defer)> &run, const std::source_location &location);
     PROMISE_API Defer(const std::shared_ptr<Task> &task);
+    PROMISE_API void settle(TaskState state, const any &arg) const;
     std::shared_ptr<Task>          task_;
     std::shared_ptr<SharedPromise> sharedPromise_;
 };
@@ -107,6 +174,7 @@ public:
     }
     template<typename ...ARGS>
     inline std::enable_if_t<!is_one_any<ARGS...>::value> reject(ARGS &&...args) const {
+        detail::addRethrowers<ARGS...>();
         reject(any{ std::vector<any>{std::forward<ARGS>(args)...} });
     }
     PROMISE_API void doContinue() const;
@@ -118,6 +186,41 @@ private:
     PROMISE_API DeferLoop(const Defer &cb);
     Defer defer_;
 };
+// Collects Defers, typically under a lock, to settle them all with one value once it is released.
+// Each is settled as by Defer::resolve()/reject(), in the order they were added; settled ones are
+// skipped. The value is boxed once for the whole group.
+class DeferBatch {
+public:
+    void add(const Defer &defer) {
+        defers_.push_back(defer);
+    }
+    void reserve(size_t size) {
+        defers_.reserve(size);
+    }
+    size_t size() const {
+        return defers_.size();
+    }
+    bool empty() const {
+        return defers_.empty();
+    }
+    template<typename ...ARGS>
+    inline std::enable_if_t<!is_one_any<ARGS...>::value> resolve(ARGS &&...args) {
+        resolve(any{ std::vector<any>{std::forward<ARGS>(args)...} });
+    }
+    template<typename ...ARGS>
+    inline std::enable_if_t<!is_one_any<ARGS...>::value> reject(ARGS &&...args) {
+        detail::addRethrowers<ARGS...>();
+        reject(any{ std::vector<any>{std::forward<ARGS>(args)...} });
+    }
+    // Settle all added Defers and empty the batch.
+    PROMISE_API void resolve(const any &arg);
+    PROMISE_API void reject(const any &arg);
+private:
+    friend PROMISE_API void resolveAll(std::span<const Defer> defers, const any &arg);
+    friend PROMISE_API void rejectAll(std::span<const Defer> defers, const any &arg);
+    PROMISE_API static void settle(std::span<const Defer> defers, TaskState state, const any &arg);
+    std::vector<Defer> defers_;
+};
 class Promise {
 public:
     PROMISE_API Promise &then(const any &deferOrPromiseOrOnResolved);
@@ -131,6 +234,7 @@ public:
     }
     template<typename ...ARGS>
     inline std::enable_if_t<!is_one_any<ARGS...>::value> reject(ARGS &&...args) const {
+        detail::addRethrowers<ARGS...>();
         reject(any{ std::vector<any>{std::forward<ARGS>(args)...} });
     }
     PROMISE_API void resolve(const any &arg) const;
@@ -138,11 +242,64 @@ public:
     PROMISE_API void clear();
     PROMISE_API operator bool() const;
     PROMISE_API void dump() const;
+    // Runs onResolved/onRejected on executor: the chain switches its default executor (see
+    // setExecutor()) to executor at this point, so what is chained after runs there too.
+    // executor must outlive the chain.
+    template<Executor EXECUTOR>
+    Promise &then_on(EXECUTOR &executor, const any &onResolved, const any &onRejected = any());
+    // Makes executor the default for this promise: its continuations are posted to executor
+    // whenever the promise settles, or a continuation is attached, outside of executor.
+    // A Service executor takes everything posted within one tick as one batch.
+    template<Executor EXECUTOR>
+    inline Promise &setExecutor(EXECUTOR &executor) {
+        EXECUTOR *target = &executor;
+        setExecutor(std::make_shared<PromiseExecutor>(PromiseExecutor{ [target](std::function<void()> task) {
+            target->execute(std::move(task));
+        }, target }));
+        return *this;
+    }
+    PROMISE_API void setExecutor(const std::shared_ptr<PromiseExecutor> &executor);
+    // Blocks the calling thread until the promise settles; returns false if timeout passed first.
+    // Never call it on the thread that has to settle the promise. Each wait()/get() adds a then()
+    // at the current end of the chain that passes the value or rejection through unchanged, so
+    // handlers can still be attached afterwards; a wait() that times out removes it again. A
+    // rejection only counts as handled once get() throws it.
+    PROMISE_API bool wait(std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) const;
+    // Waits without timeout and returns the resolved value as T, or throws the rejection value
+    // (see any::rethrow()).
+    template<typename T = void>
+    inline T get() const {
+        any value = waitValue();
+        if constexpr (!std::is_void_v<T>)
+            return value.cast<T>();
+    }
     std::shared_ptr<SharedPromise> sharedPromise_;
+private:
+    PROMISE_API std::shared_ptr<SettleWaiter> settleWaiter() const;
+    PROMISE_API any waitValue() const;
 };
-PROMISE_API Promise newPromise(const std::function<void(Defer &defer)> &run);
-PROMISE_API Promise newPromise();
+PROMISE_API Promise newPromise(const std::function<void(Defer &defer)> &run,
+                               const std::source_location &location = std::source_location::current());
+PROMISE_API Promise newPromise(const std::source_location &location = std::source_location::current());
+// Like newPromise(run), but run(defer) is only called when the promise is first consumed
+// by then()/fail()/always()/finally(), a combinator, or being returned from a handler.
+// A lazy promise that is resolved/rejected from outside or dropped never runs. Until it is
+// used it is one allocation holding a copy of run; the holder and its task come on first use.
+PROMISE_API Promise lazyPromise(const std::function<void(Defer &defer)> &run,
+                                const std::source_location &location = std::source_location::current());
 PROMISE_API Promise doWhile(const std::function<void(DeferLoop &loop)> &run);
+// Bounds the handlers attached to promise so far: currentDeadline() returns the deadline while
+// they run, so operations started inside them inherit it. Handlers attach with the deadline
+// current at the time. Deadlines only ever get earlier.
+PROMISE_API void setDeadline(const Promise &promise, std::chrono::steady_clock::time_point deadline);
+// time_point::max() when the running handler has no deadline.
+PROMISE_API std::chrono::steady_clock::time_point currentDeadline();
+// Runs func once the handler that is running has returned and the lock of its chain is
+// released, or at once when called outside a handler. For work that must not hold the chain,
+// such as resuming a coroutine.
+PROMISE_API void afterHandler(std::function<void()> func);
+PROMISE_API void resolveAll(std::span<const Defer> defers, const any &arg);
+PROMISE_API void rejectAll(std::span<const Defer> defers, const any &arg);
 template<typename ...ARGS>
 inline Promise resolve(ARGS &&...args) {
     return newPromise([&args...](Defer &defer) { defer.resolve(std::forward<ARGS>(args)...); });
@@ -151,6 +308,16 @@ template<typename ...ARGS>
 inline Promise reject(ARGS &&...args) {
     return newPromise([&args...](Defer &defer) { defer.reject(std::forward<ARGS>(args)...); });
 }
+template<Executor EXECUTOR>
+inline Promise &Promise::then_on(EXECUTOR &executor, const any &onResolved, const any &onRejected) {
+    EXECUTOR *target = &executor;
+    then([target](const any &arg) {
+        return promise::resolve(arg).setExecutor(*target);
+    }, [target](const any &arg) {
+        return promise::reject(arg).setExecutor(*target);
+    });
+    return then(onResolved, onRejected);
+}
 PROMISE_API Promise all(const std::list<Promise> &promise_list);
 template<typename PROMISE_LIST>
 inline auto all(const PROMISE_LIST &promise_list) -> std::enable_if_t<is_iterable<PROMISE_LIST>::value && !std::is_same_v<PROMISE_LIST, std::list<Promise>>, Promise> {
@@ -195,6 +362,8 @@ inline void handleUncaughtException(const any &onUncaughtException) {
     PromiseHolder::handleUncaughtException(onUncaughtException);
 }
 }
+#include "pipe.hpp"
+#include "combinators.hpp"
 #ifdef PROMISE_HEADONLY
 #include "promise_implementation.hpp"
 #endif
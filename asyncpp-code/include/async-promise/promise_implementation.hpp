@@ -5,9 +5,228 @@
 #include <stdexcept>
 #include <vector>
 #include <atomic>
+#include <chrono>
+#include <sstream>
 #include "promise.hpp"
+#include "trace.hpp"
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#else
+#include <algorithm>
+#include <thread>
+#endif
+#include "registry.hpp"
 
 namespace promise {
+struct TraceBuffer {
+    TraceBuffer(size_t capacity, uint32_t threadId)
+        : records_(capacity)
+        , head_(0)
+        , threadId_(threadId) {
+    }
+    std::vector<TraceRecord> records_;
+    std::atomic<size_t>      head_;
+    uint32_t                 threadId_;
+};
+struct TraceState {
+    std::mutex                               mutex_;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers_;
+    std::atomic<size_t>                      bufferSize_{ 1 << 14 };
+    std::atomic<uint32_t>                    nextThreadId_{ 1 };
+    std::chrono::steady_clock::time_point    origin_{ std::chrono::steady_clock::now() };
+};
+TraceState &Tracer::state() {
+    static TraceState state;
+    return state;
+}
+void Tracer::enable(bool enabled) {
+    state();
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+void Tracer::setBufferSize(size_t records) {
+    state().bufferSize_ = (records > 0 ? records : 1);
+}
+void Tracer::record(TraceEvent event, const void *promiseHolder, const void *peer, TaskState taskState) {
+    static thread_local std::shared_ptr<TraceBuffer> s_buffer;
+    if (!s_buffer) {
+        TraceState &traceState = state();
+        s_buffer = std::make_shared<TraceBuffer>(traceState.bufferSize_.load(), traceState.nextThreadId_++);
+        std::lock_guard<std::mutex> lock(traceState.mutex_);
+        traceState.buffers_.push_back(s_buffer);
+    }
+    TraceBuffer &buffer = *s_buffer;
+    size_t head = buffer.head_.load(std::memory_order_relaxed);
+    TraceRecord &record = buffer.records_[head % buffer.records_.size()];
+    record.event_ = event;
+    record.state_ = taskState;
+    record.threadId_ = buffer.threadId_;
+    record.timestampNs_ = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - state().origin_).count();
+    record.promiseHolder_ = promiseHolder;
+    record.peer_ = peer;
+    buffer.head_.store(head + 1, std::memory_order_release);
+}
+void Tracer::clear() {
+    TraceState &traceState = state();
+    std::lock_guard<std::mutex> lock(traceState.mutex_);
+    std::vector<std::shared_ptr<TraceBuffer>> alive;
+    for (const std::shared_ptr<TraceBuffer> &buffer : traceState.buffers_) {
+        buffer->head_.store(0, std::memory_order_relaxed);
+        // use_count() == 1 means the owning thread has exited
+        if (buffer.use_count() > 1)
+            alive.push_back(buffer);
+    }
+    traceState.buffers_.swap(alive);
+}
+std::vector<TraceRecord> Tracer::snapshot() {
+    TraceState &traceState = state();
+    std::lock_guard<std::mutex> lock(traceState.mutex_);
+    std::vector<TraceRecord> records;
+    for (const std::shared_ptr<TraceBuffer> &buffer : traceState.buffers_) {
+        size_t head = buffer->head_.load(std::memory_order_acquire);
+        size_t capacity = buffer->records_.size();
+        size_t count = (head < capacity ? head : capacity);
+        for (size_t i = head - count; i < head; ++i) {
+            records.push_back(buffer->records_[i % capacity]);
+        }
+    }
+    return records;
+}
+void Tracer::dumpChromeTrace(std::ostream &out) {
+    std::vector<TraceRecord> records = snapshot();
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    char buf[64];
+    for (const TraceRecord &record : records) {
+        const char *name = "";
+        const char *phase = "i";
+        switch (record.event_) {
+        case TraceEvent::kCreate: name = "newPromise"; break;
+        case TraceEvent::kContinuationBegin:
+        case TraceEvent::kContinuationEnd:
+            phase = (record.event_ == TraceEvent::kContinuationBegin ? "B" : "E");
+            name = (record.state_ == TaskState::kRejected ? "onRejected" : "onResolved");
+            break;
+        case TraceEvent::kSettle: name = (record.state_ == TaskState::kRejected ? "reject" : "resolve"); break;
+        case TraceEvent::kJoin: name = "join"; break;
+        }
+        if (!first) out << ",";
+        first = false;
+        snprintf(buf, sizeof(buf), "%llu.%03u",
+            (unsigned long long)(record.timestampNs_ / 1000), (unsigned)(record.timestampNs_ % 1000));
+        out << "{\"name\":\"" << name << "\",\"cat\":\"promise\",\"ph\":\"" << phase
+            << "\",\"pid\":1,\"tid\":" << record.threadId_ << ",\"ts\":" << buf;
+        if (phase[0] == 'i')
+            out << ",\"s\":\"t\"";
+        snprintf(buf, sizeof(buf), "%p", record.promiseHolder_);
+        out << ",\"args\":{\"promise\":\"" << buf << "\"";
+        if (record.peer_ != nullptr) {
+            snprintf(buf, sizeof(buf), "%p", record.peer_);
+            out << (record.event_ == TraceEvent::kJoin ? ",\"joined\":\"" : ",\"task\":\"") << buf << "\"";
+        }
+        out << "}}";
+    }
+    out << "]}\n";
+}
+std::string Tracer::dumpChromeTrace() {
+    std::ostringstream out;
+    dumpChromeTrace(out);
+    return out.str();
+}
+struct RegistryShard {
+    std::mutex          mutex_;
+    RegistryEntry       *head_ = nullptr;
+    std::atomic<size_t> size_{ 0 };
+};
+static constexpr size_t kRegistryShards = 64;
+inline RegistryShard *registryShards() {
+    static RegistryShard shards[kRegistryShards];
+    return shards;
+}
+void PromiseRegistry::enable(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+void PromiseRegistry::add(PromiseHolder *promiseHolder, const std::source_location &location) {
+    static std::atomic<size_t> s_nextShard{ 0 };
+    static thread_local size_t s_shard = s_nextShard++ % kRegistryShards;
+    RegistryEntry *entry = new RegistryEntry{
+        promiseHolder, location, std::chrono::steady_clock::now(), nullptr, nullptr, s_shard
+    };
+    RegistryShard &shard = registryShards()[s_shard];
+    std::lock_guard<std::mutex> lock(shard.mutex_);
+    entry->next_ = shard.head_;
+    if (shard.head_ != nullptr)
+        shard.head_->prev_ = entry;
+    shard.head_ = entry;
+    ++shard.size_;
+    promiseHolder->registryEntry_ = entry;
+}
+void PromiseRegistry::remove(RegistryEntry *entry) {
+    {
+        RegistryShard &shard = registryShards()[entry->shard_];
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        if (entry->prev_ != nullptr)
+            entry->prev_->next_ = entry->next_;
+        else
+            shard.head_ = entry->next_;
+        if (entry->next_ != nullptr)
+            entry->next_->prev_ = entry->prev_;
+        --shard.size_;
+    }
+    delete entry;
+}
+size_t PromiseRegistry::size() {
+    size_t size = 0;
+    for (size_t i = 0; i < kRegistryShards; ++i)
+        size += registryShards()[i].size_.load(std::memory_order_relaxed);
+    return size;
+}
+static std::vector<PromiseInfo> listRegistry(bool onlyPending, std::chrono::steady_clock::duration threshold) {
+    std::vector<PromiseInfo> infos;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kRegistryShards; ++i) {
+        RegistryShard &shard = registryShards()[i];
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        for (RegistryEntry *entry = shard.head_; entry != nullptr; entry = entry->next_) {
+            std::chrono::steady_clock::duration age = now - entry->createdAt_;
+            if (onlyPending && age < threshold)
+                continue;
+            // try_lock: the holder may be locked by a thread that is waiting for this shard
+            PromiseHolder *promiseHolder = entry->promiseHolder_;
+            std::unique_lock<std::recursive_mutex> holderLock(promiseHolder->mutex_, std::try_to_lock);
+            if (!holderLock.owns_lock())
+                continue;
+            if (onlyPending && promiseHolder->state_ != TaskState::kPending)
+                continue;
+            infos.push_back(PromiseInfo{
+                promiseHolder, entry->location_, age, promiseHolder->state_, promiseHolder->pendingTasks_.size()
+            });
+        }
+    }
+    return infos;
+}
+std::vector<PromiseInfo> PromiseRegistry::list() {
+    return listRegistry(false, std::chrono::steady_clock::duration::zero());
+}
+std::vector<PromiseInfo> PromiseRegistry::pendingLongerThan(std::chrono::steady_clock::duration threshold) {
+    return listRegistry(true, threshold);
+}
+void PromiseRegistry::dumpPending(std::chrono::steady_clock::duration threshold, FILE *out) {
+    for (const PromiseInfo &info : pendingLongerThan(threshold)) {
+        fprintf(out, "pending promise %p, age = %lld ms, pendingTasks = %d, created at %s:%u (%s)\n",
+            info.promiseHolder_,
+            (long long)std::chrono::duration_cast<std::chrono::milliseconds>(info.age_).count(),
+            (int)info.pendingTasks_,
+            info.location_.file_name(), (unsigned)info.location_.line(), info.location_.function_name());
+    }
+}
+static inline void traceEvent(TraceEvent event, const void *promiseHolder, const void *peer, TaskState state) {
+    if (Tracer::isEnabled())
+        Tracer::record(event, promiseHolder, peer, state);
+}
 static inline void healthyCheck(int line, PromiseHolder *promiseHolder) {
     (void)line;
     (void)promiseHolder;
@@ -18,10 +237,10 @@ static inline void healthyCheck(int line, PromiseHolder *promiseHolder) {
     }
     for (const auto &owner_ : promiseHolder->owners_) {
         auto owner = owner_.lock();
-        if (owner && owner->promiseHolder_.get() != promiseHolder) {
+        if (owner && owner->promiseHolder_.load().get() != promiseHolder) {
             fprintf(stderr, "line = %d, %d, owner->promiseHolder_ = %p, promiseHolder = %p\n",
                 line, __LINE__,
-                owner->promiseHolder_.get(),
+                owner->promiseHolder_.load().get(),
                 promiseHolder);
             throw std::runtime_error("");
         }
@@ -36,9 +255,9 @@ static inline void healthyCheck(int line, PromiseHolder *promiseHolder) {
                 promiseHolder, task.get(), (int)task->state_);
             throw std::runtime_error("");
         }
-        if (task->promiseHolder_.lock().get() != promiseHolder) {
+        if (task->promiseHolder_.load().lock().get() != promiseHolder) {
             fprintf(stderr, "line = %d, %d, promiseHolder = %p, task = %p, task->promiseHolder_ = %p\n", line, __LINE__,
-                promiseHolder, task.get(), task->promiseHolder_.lock().get());
+                promiseHolder, task.get(), task->promiseHolder_.load().lock().get());
             throw std::runtime_error("");
         }
     }
@@ -53,9 +272,10 @@ void Promise::dump() const {
 }
 void SharedPromise::dump() const {
 #ifndef NDEBUG
-    printf("SharedPromise = %p, PromiseHolder = %p\n", this, this->promiseHolder_.get());
-    if (this->promiseHolder_)
-        this->promiseHolder_->dump();
+    std::shared_ptr<PromiseHolder> promiseHolder = this->promiseHolder_.load();
+    printf("SharedPromise = %p, PromiseHolder = %p\n", this, promiseHolder.get());
+    if (promiseHolder)
+        promiseHolder->dump();
 #endif
 }
 void PromiseHolder::dump() const {
@@ -67,7 +287,7 @@ void PromiseHolder::dump() const {
     }
     for (const auto &task : pendingTasks_) {
         if (task) {
-            auto promiseHolder = task->promiseHolder_.lock();
+            auto promiseHolder = task->promiseHolder_.load().lock();
             printf("  task = %p, PromiseHolder = %p\n", task.get(), promiseHolder.get());
         }
         else {
@@ -76,14 +296,47 @@ void PromiseHolder::dump() const {
     }
 #endif
 }
+static inline std::chrono::steady_clock::time_point &currentDeadlineRef() {
+    static thread_local std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    return deadline;
+}
+// Publishes the deadline of the chain being run to the handler it calls.
+struct DeadlineScope {
+    DeadlineScope(std::chrono::steady_clock::time_point deadline)
+        : saved_(currentDeadlineRef()) {
+        if (deadline < saved_) currentDeadlineRef() = deadline;
+    }
+    ~DeadlineScope() {
+        currentDeadlineRef() = saved_;
+    }
+    const std::chrono::steady_clock::time_point saved_;
+};
+// Collects what the handler being run passes to afterHandler(), for call() to run unlocked.
+static inline std::vector<std::function<void()>> *&afterHandlerRef() {
+    static thread_local std::vector<std::function<void()>> *funcs = nullptr;
+    return funcs;
+}
+struct AfterHandlerScope {
+    AfterHandlerScope(std::vector<std::function<void()>> &funcs)
+        : saved_(afterHandlerRef()) {
+        afterHandlerRef() = &funcs;
+    }
+    ~AfterHandlerScope() {
+        afterHandlerRef() = saved_;
+    }
+    std::vector<std::function<void()>> *const saved_;
+};
 static inline void join(const std::shared_ptr<PromiseHolder> &left, const std::shared_ptr<PromiseHolder> &right) {
     healthyCheck(__LINE__, left.get());
     healthyCheck(__LINE__, right.get());
+    traceEvent(TraceEvent::kJoin, left.get(), right.get(), left->state_);
+    if (!left->executor_)
+        left->executor_ = right->executor_;
     for (const std::shared_ptr<Task> &task : right->pendingTasks_) {
-        task->promiseHolder_ = left;
+        task->promiseHolder_.store(left);
     }
     left->pendingTasks_.splice(left->pendingTasks_.end(), right->pendingTasks_);
-    std::list<std::weak_ptr<SharedPromise>> owners;
+    pm_list<std::weak_ptr<SharedPromise>> owners;
     owners.splice(owners.end(), right->owners_);
     right->state_ = TaskState::kResolved;
     if(owners.size() > 100) {
@@ -92,28 +345,159 @@ static inline void join(const std::shared_ptr<PromiseHolder> &left, const std::s
     for (const std::weak_ptr<SharedPromise> &owner_ : owners) {
         std::shared_ptr<SharedPromise> owner = owner_.lock();
         if (owner) {
-            owner->promiseHolder_ = left;
+            owner->promiseHolder_.store(left);
             left->owners_.push_back(owner);
         }
     }
     healthyCheck(__LINE__, left.get());
     healthyCheck(__LINE__, right.get());
 }
+// SharedPromise of a lazyPromise(): run_ and the holder only meet when the promise is used.
+struct LazySharedPromise : SharedPromise, std::enable_shared_from_this<LazySharedPromise> {
+    LazySharedPromise(const std::function<void(Defer &defer)> &run, const std::source_location &location)
+        : run_(run)
+        , location_(location) {
+    }
+    std::function<void(Defer &defer)> run_; // moved out by runLazy()
+    const std::source_location        location_;
+};
+// A pending holder with the task of its Defer, as newPromise() makes it.
+static inline std::shared_ptr<PromiseHolder> newHolder(const std::weak_ptr<SharedPromise> &owner) {
+    std::shared_ptr<PromiseHolder> promiseHolder = pm_make_shared<PromiseHolder, AllocKind::kPromiseHolder>();
+    promiseHolder->owners_.push_back(owner);
+    promiseHolder->pendingTasks_.push_back(pm_make_shared<Task, AllocKind::kTask>(
+        TaskState::kPending,
+        std::weak_ptr<PromiseHolder>(promiseHolder),
+        any(),
+        any(),
+        currentDeadlineRef()
+    ));
+    return promiseHolder;
+}
+static inline void registerHolder(PromiseHolder *promiseHolder, const std::source_location &location) {
+    traceEvent(TraceEvent::kCreate, promiseHolder, nullptr, TaskState::kPending);
+    if (PromiseRegistry::isEnabled())
+        PromiseRegistry::add(promiseHolder, location);
+}
+// The holder of a promise; created tells whether this call made a lazyPromise()'s.
+static inline std::shared_ptr<PromiseHolder> holderOf(const SharedPromise &sharedPromise, bool *created = nullptr) {
+    std::shared_ptr<PromiseHolder> promiseHolder = sharedPromise.promiseHolder_.load();
+    if (promiseHolder) return promiseHolder;
+    LazySharedPromise &lazy = static_cast<LazySharedPromise &>(const_cast<SharedPromise &>(sharedPromise));
+    std::shared_ptr<PromiseHolder> newOne = newHolder(lazy.weak_from_this());
+    if (!lazy.promiseHolder_.compare_exchange_strong(promiseHolder, newOne))
+        return promiseHolder;
+    registerHolder(newOne.get(), lazy.location_);
+    if (created != nullptr) *created = true;
+    return newOne;
+}
+using HolderLock = std::unique_lock<std::recursive_mutex>;
+// Locks the holder a promise runs on, looking it up again if join() moved the promise meanwhile.
+static inline HolderLock lockHolder(const SharedPromise &sharedPromise, std::shared_ptr<PromiseHolder> &promiseHolder) {
+    while (true) {
+        promiseHolder = holderOf(sharedPromise);
+        HolderLock lock(promiseHolder->mutex_);
+        if (promiseHolder == sharedPromise.promiseHolder_.load()) return lock;
+    }
+}
+// lockHolder() for two promises, without lock-order deadlocks.
+static inline std::pair<HolderLock, HolderLock> lockHolders(const SharedPromise &left, std::shared_ptr<PromiseHolder> &leftHolder,
+                                                           const SharedPromise &right, std::shared_ptr<PromiseHolder> &rightHolder) {
+    while (true) {
+        leftHolder = holderOf(left);
+        rightHolder = holderOf(right);
+        HolderLock leftLock(leftHolder->mutex_, std::defer_lock);
+        HolderLock rightLock(rightHolder->mutex_, std::defer_lock);
+        std::lock(leftLock, rightLock);
+        if (leftHolder == left.promiseHolder_.load() && rightHolder == right.promiseHolder_.load())
+            return { std::move(leftLock), std::move(rightLock) };
+    }
+}
+}
+// Runs a lazyPromise() that holderOf() has just created a holder for, for a consumer.
+void promise::PromiseHolder::runLazy(const SharedPromise &sharedPromise) {
+    LazySharedPromise &lazy = static_cast<LazySharedPromise &>(const_cast<SharedPromise &>(sharedPromise));
+    std::function<void(Defer &defer)> run = std::move(lazy.run_);
+    std::shared_ptr<Task> task;
+    {
+        std::shared_ptr<PromiseHolder> promiseHolder;
+        HolderLock lock = lockHolder(sharedPromise, promiseHolder);
+        if (promiseHolder->state_ != TaskState::kPending || promiseHolder->pendingTasks_.empty()) return;
+        task = promiseHolder->pendingTasks_.front();
+    }
+    Defer defer(task);
+    try {
+        run(defer);
+    }
+    catch (...) {
+        defer.reject(std::current_exception());
+    }
+}
+namespace promise {
+// Joins a chain into the promise its handler returned and returns the holder it now runs on.
+// Called with the chain's lock held.
+static inline std::shared_ptr<PromiseHolder> joinReturned(const Promise &promise, const std::shared_ptr<PromiseHolder> &promiseHolder, bool &lazy) {
+    holderOf(*promise.sharedPromise_, &lazy);
+    std::shared_ptr<PromiseHolder> joinedHolder;
+    HolderLock lock = lockHolder(*promise.sharedPromise_, joinedHolder);
+    join(joinedHolder, promiseHolder);
+    return joinedHolder;
+}
+static inline const void *&currentExecutorRef() {
+    static thread_local const void *executor = nullptr;
+    return executor;
+}
+promise::ExecutorScope::ExecutorScope(const void *id)
+    : saved_(currentExecutorRef()) {
+    currentExecutorRef() = id;
+}
+promise::ExecutorScope::~ExecutorScope() {
+    currentExecutorRef() = saved_;
+}
+// Whether the next task of a holder must run on its executor rather than here. Called with the lock held.
+static inline bool needsPost(const PromiseHolder &promiseHolder) {
+    return promiseHolder.executor_ && promiseHolder.state_ != TaskState::kPending
+        && promiseHolder.executor_->id_ != currentExecutorRef();
+}
+static inline void call(std::shared_ptr<Task> task);
+// The posted call keeps the holder alive: a chain being handed over may have no other owner.
+static inline void post(const std::shared_ptr<PromiseExecutor> &executor,
+                        const std::shared_ptr<PromiseHolder> &promiseHolder, const std::shared_ptr<Task> &task) {
+    executor->execute_([executor, promiseHolder, task]() {
+        ExecutorScope scope(executor->id_);
+        call(task);
+    });
+}
 static inline void call(std::shared_ptr<Task> task) {
     std::shared_ptr<PromiseHolder> promiseHolder;
     while (true) {
-        promiseHolder = task->promiseHolder_.lock();
+        promiseHolder = task->promiseHolder_.load().lock();
         if (!promiseHolder) return;
-        std::unique_lock<std::recursive_mutex> lock(promiseHolder->mutex_);
+        std::shared_ptr<SharedPromise> lazyReturned;
+        std::vector<std::function<void()>> afterHandler;
+        {
+            std::unique_lock<std::recursive_mutex> lock(promiseHolder->mutex_);
             if (task->state_ != TaskState::kPending) return;
             if (promiseHolder->state_ == TaskState::kPending) return;
-            std::list<std::shared_ptr<Task>> &pendingTasks = promiseHolder->pendingTasks_;
-            while (pendingTasks.front() != task) {
-                promiseHolder->cond_.wait(lock);
+            pm_list<std::shared_ptr<Task>> &pendingTasks = promiseHolder->pendingTasks_;
+            if (pendingTasks.empty() || pendingTasks.front() != task) return;
+            if (needsPost(*promiseHolder)) {
+                post(promiseHolder->executor_, promiseHolder, task);
+                return;
             }
-            assert(pendingTasks.front() == task);
             pendingTasks.pop_front();
             task->state_ = promiseHolder->state_;
+            // Only tasks with a handler for this outcome are traced; pass-through ones are not.
+            bool traced = false;
+            const PromiseHolder *tracedHolder = promiseHolder.get();
+            if (Tracer::isEnabled()) {
+                const any &handler = (task->state_ == TaskState::kResolved ? task->onResolved_ : task->onRejected_);
+                traced = !handler.empty() && handler.type() != type_id<std::nullptr_t>();
+                if (traced)
+                    Tracer::record(TraceEvent::kContinuationBegin, tracedHolder, task.get(), task->state_);
+            }
+            DeadlineScope deadlineScope(task->deadline_);
+            AfterHandlerScope afterHandlerScope(afterHandler);
             try {
                 if (promiseHolder->state_ == TaskState::kResolved) {
                     if (task->onResolved_.empty()
@@ -121,15 +505,21 @@ static inline void call(std::shared_ptr<Task> task) {
                     }
                     else {
                         promiseHolder->state_ = TaskState::kPending;
+                        promiseHolder->handled_ = false;
                         const any &value = task->onResolved_.call(promiseHolder->value_);
-                        if (value.type() != type_id<Promise>()) {
+                        if (value.type() == type_id<KeepOutcome>() || value.type() == type_id<ObserveOutcome>()) {
+                            promiseHolder->state_ = TaskState::kResolved;
+                        }
+                        else if (value.type() != type_id<Promise>()) {
                             promiseHolder->value_ = value;
                             promiseHolder->state_ = TaskState::kResolved;
                         }
                         else {
-                            Promise &promise = value.cast<Promise &>();
-                            join(promise.sharedPromise_->promiseHolder_, promiseHolder);
-                            promiseHolder = promise.sharedPromise_->promiseHolder_;
+                            const Promise &returned = value.cast<Promise &>();
+                            bool lazy = false;
+                            promiseHolder = joinReturned(returned, promiseHolder, lazy);
+                            if (lazy)
+                                lazyReturned = returned.sharedPromise_;
                         }
                     }
                 }
@@ -139,16 +529,28 @@ static inline void call(std::shared_ptr<Task> task) {
                     }
                     else {
                         try {
+                            const bool handled = promiseHolder->handled_;
                             promiseHolder->state_ = TaskState::kPending;
+                            promiseHolder->handled_ = false;
                             const any &value = task->onRejected_.call(promiseHolder->value_);
-                            if (value.type() != type_id<Promise>()) {
+                            if (value.type() == type_id<KeepOutcome>()) {
+                                promiseHolder->state_ = TaskState::kRejected;
+                                promiseHolder->handled_ = true;
+                            }
+                            else if (value.type() == type_id<ObserveOutcome>()) {
+                                promiseHolder->state_ = TaskState::kRejected;
+                                promiseHolder->handled_ = handled;
+                            }
+                            else if (value.type() != type_id<Promise>()) {
                                 promiseHolder->value_ = value;
                                 promiseHolder->state_ = TaskState::kResolved;
                             }
                             else {
-                                Promise &promise = value.cast<Promise &>();
-                                join(promise.sharedPromise_->promiseHolder_, promiseHolder);
-                                promiseHolder = promise.sharedPromise_->promiseHolder_;
+                                const Promise &returned = value.cast<Promise &>();
+                                bool lazy = false;
+                                promiseHolder = joinReturned(returned, promiseHolder, lazy);
+                                if (lazy)
+                                    lazyReturned = returned.sharedPromise_;
                             }
                         }
                         catch (const bad_any_cast &) {
@@ -166,40 +568,112 @@ static inline void call(std::shared_ptr<Task> task) {
                 promiseHolder->value_ = std::current_exception();
                 promiseHolder->state_ = TaskState::kRejected;
             }
+            // Recorded even if tracing was turned off meanwhile, so every begin has its end.
+            if (traced)
+                Tracer::record(TraceEvent::kContinuationEnd, tracedHolder, task.get(), task->state_);
             task->onResolved_.clear();
             task->onRejected_.clear();
         }
-        std::list<std::shared_ptr<Task>> &pendingTasks2 = promiseHolder->pendingTasks_;
-        if (pendingTasks2.size() == 0) {
-            return;
+        for (std::function<void()> &func : afterHandler)
+            func();
+        // A lazy promise returned from the handler is consumed by this chain now.
+        if (lazyReturned)
+            PromiseHolder::runLazy(*lazyReturned);
+        {
+            std::lock_guard<std::recursive_mutex> lock(promiseHolder->mutex_);
+            pm_list<std::shared_ptr<Task>> &pendingTasks2 = promiseHolder->pendingTasks_;
+            if (pendingTasks2.size() == 0) {
+                return;
+            }
+            task = pendingTasks2.front();
         }
-        task = pendingTasks2.front();
     }
 }
+// The task stays pending until call() runs it, the holder is settled at once. Called with the lock held.
+static inline bool isSettled(const Task &task, const PromiseHolder &promiseHolder) {
+    return task.state_ != TaskState::kPending || promiseHolder.state_ != TaskState::kPending;
+}
+// Settles a promise from outside its chain; one that is settled already keeps its outcome.
+static inline void settlePromise(const SharedPromise &sharedPromise, TaskState state, const any &arg) {
+    std::shared_ptr<Task> task;
+    {
+        std::shared_ptr<PromiseHolder> promiseHolder;
+        HolderLock lock = lockHolder(sharedPromise, promiseHolder);
+        if (promiseHolder->state_ != TaskState::kPending) return;
+        promiseHolder->state_ = state;
+        promiseHolder->value_ = arg;
+        traceEvent(TraceEvent::kSettle, promiseHolder.get(), nullptr, state);
+        if (!promiseHolder->pendingTasks_.empty())
+            task = promiseHolder->pendingTasks_.front();
+    }
+    if (task)
+        call(task);
+}
+}
 promise::Defer::Defer(const std::shared_ptr<Task> &task) {
-    std::shared_ptr<SharedPromise> sharedPromise(new SharedPromise{ task->promiseHolder_.lock() });
+    std::shared_ptr<SharedPromise> sharedPromise = pm_make_shared<SharedPromise, AllocKind::kSharedPromise>(task->promiseHolder_.load().lock());
     task_ = task;
     sharedPromise_ = sharedPromise;
 }
 void promise::Defer::resolve(const any &arg) const {
-    std::unique_lock<std::recursive_mutex> lock(sharedPromise_->promiseHolder_->mutex_);
-    if (task_->state_ != TaskState::kPending) return;
-    std::shared_ptr<PromiseHolder> &promiseHolder = sharedPromise_->promiseHolder_;
-    promiseHolder->state_ = TaskState::kResolved;
-    promiseHolder->value_ = arg;
-    call(task_);
+    settle(TaskState::kResolved, arg);
 }
 void promise::Defer::reject(const any &arg) const {
-    std::unique_lock<std::recursive_mutex> lock(sharedPromise_->promiseHolder_->mutex_);
-    if (task_->state_ != TaskState::kPending) return;
-    std::shared_ptr<PromiseHolder> &promiseHolder = sharedPromise_->promiseHolder_;
-    promiseHolder->state_ = TaskState::kRejected;
-    promiseHolder->value_ = arg;
+    settle(TaskState::kRejected, arg);
+}
+void promise::Defer::settle(TaskState state, const any &arg) const {
+    {
+        std::shared_ptr<PromiseHolder> promiseHolder;
+        HolderLock lock = lockHolder(*sharedPromise_, promiseHolder);
+        if (isSettled(*task_, *promiseHolder)) return;
+        promiseHolder->state_ = state;
+        promiseHolder->value_ = arg;
+        traceEvent(TraceEvent::kSettle, promiseHolder.get(), task_.get(), state);
+    }
     call(task_);
 }
 promise::Promise promise::Defer::getPromise() const {
     return Promise{ sharedPromise_ };
 }
+void promise::DeferBatch::settle(std::span<const Defer> defers, TaskState state, const any &arg) {
+    for (const Defer &defer : defers)
+        defer.settle(state, arg);
+}
+void promise::DeferBatch::resolve(const any &arg) {
+    std::vector<Defer> defers;
+    defers.swap(defers_);
+    settle(defers, TaskState::kResolved, arg);
+}
+void promise::DeferBatch::reject(const any &arg) {
+    std::vector<Defer> defers;
+    defers.swap(defers_);
+    settle(defers, TaskState::kRejected, arg);
+}
+void promise::setDeadline(const Promise &promise, std::chrono::steady_clock::time_point deadline) {
+    if (!promise.sharedPromise_) return;
+    std::shared_ptr<PromiseHolder> promiseHolder;
+    HolderLock lock = lockHolder(*promise.sharedPromise_, promiseHolder);
+    for (const std::shared_ptr<Task> &task : promiseHolder->pendingTasks_) {
+        if (deadline < task->deadline_)
+            task->deadline_ = deadline;
+    }
+}
+void promise::afterHandler(std::function<void()> func) {
+    std::vector<std::function<void()>> *funcs = afterHandlerRef();
+    if (funcs != nullptr)
+        funcs->push_back(std::move(func));
+    else
+        func();
+}
+std::chrono::steady_clock::time_point promise::currentDeadline() {
+    return currentDeadlineRef();
+}
+void promise::resolveAll(std::span<const Defer> defers, const any &arg) {
+    DeferBatch::settle(defers, TaskState::kResolved, arg);
+}
+void promise::rejectAll(std::span<const Defer> defers, const any &arg) {
+    DeferBatch::settle(defers, TaskState::kRejected, arg);
+}
 struct DoBreakTag {};
 promise::DeferLoop::DeferLoop(const promise::Defer &defer)
     : defer_(defer) {
@@ -220,13 +694,19 @@ promise::PromiseHolder::PromiseHolder()
     : owners_()
     , pendingTasks_()
     , state_(TaskState::kPending)
+    , handled_(false)
     , value_()
     , mutex_()
     , cond_()
+    , registryEntry_(nullptr)
+    , executor_()
 {
 }
 promise::PromiseHolder::~PromiseHolder() {
-    if (this->state_ == TaskState::kRejected) {
+    if (this->registryEntry_ != nullptr) {
+        PromiseRegistry::remove(this->registryEntry_);
+    }
+    if (this->state_ == TaskState::kRejected && !this->handled_) {
         static thread_local std::atomic<bool> s_inUncaughtExceptionHandler{false};
         if(s_inUncaughtExceptionHandler) return;
         s_inUncaughtExceptionHandler = true;
@@ -274,63 +754,124 @@ promise::Promise &promise::Promise::then(const promise::any &deferOrPromiseOrOnR
     if (deferOrPromiseOrOnResolved.type() == type_id<Defer>()) {
         Defer &defer = deferOrPromiseOrOnResolved.cast<Defer &>();
         Promise promise = defer.getPromise();
-        Promise &ret = then([defer](const any &arg) -> any {
+        // Set when this chain settled the defer, which then must not reject it back.
+        std::shared_ptr<std::atomic<bool>> forwarded = std::make_shared<std::atomic<bool>>(false);
+        Promise &ret = then([defer, forwarded](const any &arg) -> any {
+            *forwarded = true;
             defer.resolve(arg);
             return nullptr;
-        }, [defer](const any &arg) ->any {
+        }, [defer, forwarded](const any &arg) ->any {
+            *forwarded = true;
             defer.reject(arg);
             return nullptr;
         });
         promise.finally([=]() {
-            ret.reject();
+            if (!*forwarded)
+                ret.reject();
         });
         return ret;
     }
     else if (deferOrPromiseOrOnResolved.type() == type_id<DeferLoop>()) {
         DeferLoop &loop = deferOrPromiseOrOnResolved.cast<DeferLoop &>();
         Promise promise = loop.getPromise();
-        Promise &ret = then([loop](const any &arg) -> any {
+        std::shared_ptr<std::atomic<bool>> forwarded = std::make_shared<std::atomic<bool>>(false);
+        Promise &ret = then([loop, forwarded](const any &arg) -> any {
             (void)arg;
+            *forwarded = true;
             loop.doContinue();
             return nullptr;
-        }, [loop](const any &arg) ->any {
+        }, [loop, forwarded](const any &arg) ->any {
+            *forwarded = true;
             loop.reject(arg);
             return nullptr;
         });
         promise.finally([=]() {
-            ret.reject();
+            if (!*forwarded)
+                ret.reject();
         });
         return ret;
     }
     else if (deferOrPromiseOrOnResolved.type() == type_id<Promise>()) {
         Promise &promise = deferOrPromiseOrOnResolved.cast<Promise &>();
         std::shared_ptr<Task> task;
-        if (promise.sharedPromise_ && promise.sharedPromise_->promiseHolder_) {
-            join(this->sharedPromise_->promiseHolder_, promise.sharedPromise_->promiseHolder_);
-            if (this->sharedPromise_->promiseHolder_->pendingTasks_.size() > 0) {
-                task = this->sharedPromise_->promiseHolder_->pendingTasks_.front();
+        std::shared_ptr<PromiseHolder> promiseHolder;
+        bool lazy = false;
+        holderOf(*sharedPromise_, &lazy);
+        if (promise.sharedPromise_) {
+            bool joinedLazy = false;
+            holderOf(*promise.sharedPromise_, &joinedLazy);
+            if (joinedLazy)
+                PromiseHolder::runLazy(*promise.sharedPromise_);
+            std::shared_ptr<PromiseHolder> joinedHolder;
+            auto locks = lockHolders(*sharedPromise_, promiseHolder, *promise.sharedPromise_, joinedHolder);
+            join(promiseHolder, joinedHolder);
+            if (promiseHolder->pendingTasks_.size() > 0) {
+                task = promiseHolder->pendingTasks_.front();
             }
         }
         if(task)
             call(task);
+        if (lazy)
+            PromiseHolder::runLazy(*sharedPromise_);
         return *this;
     }
     else {
         return then(deferOrPromiseOrOnResolved, any());
     }
 }
-promise::Promise &promise::Promise::then(const promise::any &onResolved, const promise::any &onRejected) {
+namespace promise {
+// then() without the Promise: returns the task it attached.
+static inline std::shared_ptr<Task> attachTask(const SharedPromise &sharedPromise, const any &onResolved, const any &onRejected) {
     std::shared_ptr<Task> task;
-    task = std::make_shared<Task>(Task {
-        TaskState::kPending,
-        sharedPromise_->promiseHolder_,
-        onResolved,
-        onRejected
-    });
-    sharedPromise_->promiseHolder_->pendingTasks_.push_back(task);
+    std::shared_ptr<PromiseHolder> promiseHolder;
+    bool lazy = false;
+    holderOf(sharedPromise, &lazy);
+    {
+        HolderLock lock = lockHolder(sharedPromise, promiseHolder);
+        task = pm_make_shared<Task, AllocKind::kTask>(
+            TaskState::kPending,
+            std::weak_ptr<PromiseHolder>(promiseHolder),
+            onResolved,
+            onRejected,
+            currentDeadlineRef()
+        );
+        promiseHolder->pendingTasks_.push_back(task);
+    }
+    if (lazy)
+        PromiseHolder::runLazy(sharedPromise);
     call(task);
+    return task;
+}
+// Removes a task that has not run from its chain, unless the chain is settled already.
+static inline void detachTask(const std::shared_ptr<Task> &task) {
+    while (true) {
+        std::shared_ptr<PromiseHolder> promiseHolder = task->promiseHolder_.load().lock();
+        if (!promiseHolder) return;
+        std::lock_guard<std::recursive_mutex> lock(promiseHolder->mutex_);
+        // join() may have moved the task meanwhile.
+        if (task->promiseHolder_.load().lock() != promiseHolder) continue;
+        if (task->state_ == TaskState::kPending && promiseHolder->state_ == TaskState::kPending)
+            promiseHolder->pendingTasks_.remove(task);
+        return;
+    }
+}
+}
+promise::Promise &promise::Promise::then(const promise::any &onResolved, const promise::any &onRejected) {
+    attachTask(*sharedPromise_, onResolved, onRejected);
     return *this;
 }
+void promise::Promise::setExecutor(const std::shared_ptr<PromiseExecutor> &executor) {
+    if (!sharedPromise_) return;
+    bool lazy = false;
+    holderOf(*sharedPromise_, &lazy);
+    {
+        std::shared_ptr<PromiseHolder> promiseHolder;
+        HolderLock lock = lockHolder(*sharedPromise_, promiseHolder);
+        promiseHolder->executor_ = executor;
+    }
+    if (lazy)
+        PromiseHolder::runLazy(*sharedPromise_);
+}
 promise::Promise &promise::Promise::fail(const promise::any &onRejected) {
     return then(any(), onRejected);
 }
@@ -358,28 +899,11 @@ promise::Promise &promise::Promise::finally(const promise::any &onFinally) {
 }
 void promise::Promise::resolve(const promise::any &arg) const {
     if (!this->sharedPromise_) return;
-    sharedPromise_->promiseHolder_->state_ = TaskState::kResolved;
-    sharedPromise_->promiseHolder_->value_ = arg;
-    std::shared_ptr<Task> task;
-    std::list<std::shared_ptr<Task>> &pendingTasks_ = sharedPromise_->promiseHolder_->pendingTasks_;
-    if (pendingTasks_.size() > 0) {
-        task = pendingTasks_.front();
-    }
-    if (task) {
-        call(task);
-    }
+    settlePromise(*sharedPromise_, TaskState::kResolved, arg);
 }
 void promise::Promise::reject(const promise::any &arg) const {
     if (!this->sharedPromise_) return;
-    std::shared_ptr<Task> task;
-    std::list<std::shared_ptr<Task>> &pendingTasks_ = this->sharedPromise_->promiseHolder_->pendingTasks_;
-    if (pendingTasks_.size() > 0) {
-        task = pendingTasks_.front();
-    }
-    if (task) {
-        Defer defer(task);
-        defer.reject(arg);
-    }
+    settlePromise(*sharedPromise_, TaskState::kRejected, arg);
 }
 void promise::Promise::clear() {
     sharedPromise_.reset();
@@ -387,14 +911,102 @@ void promise::Promise::clear() {
 promise::Promise::operator bool() const {
     return sharedPromise_.operator bool();
 }
-promise::Promise promise::newPromise(const std::function<void(promise::Defer &defer)> &run) {
-    Promise promise;
-    promise.sharedPromise_ = std::make_shared<SharedPromise>();
-    promise.sharedPromise_->promiseHolder_ = std::make_shared<PromiseHolder>();
-    promise.sharedPromise_->promiseHolder_->owners_.push_back(promise.sharedPromise_);
-    promise.then(any(), any());
-    std::shared_ptr<Task> &task = promise.sharedPromise_->promiseHolder_->pendingTasks_.front();
-    Defer defer(task);
+namespace promise {
+// Sleeps while *word == expected, at most timeout (nullptr for no limit).
+static inline void waitOnWord(std::atomic<uint32_t> &word, uint32_t expected, const std::chrono::nanoseconds *timeout) {
+#if defined(__linux__)
+    struct timespec ts;
+    if (timeout != nullptr) {
+        ts.tv_sec = (time_t)(timeout->count() / 1000000000);
+        ts.tv_nsec = (long)(timeout->count() % 1000000000);
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, expected,
+            timeout != nullptr ? &ts : nullptr, nullptr, 0);
+#else
+    if (timeout == nullptr)
+        word.wait(expected, std::memory_order_acquire);
+    else // no portable timed wait on an atomic: poll
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(*timeout, std::chrono::milliseconds(1)));
+#endif
+}
+static inline void wakeWord(std::atomic<uint32_t> &word) {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+    word.notify_all();
+#endif
+}
+static inline void settleWaiterWith(SettleWaiter &waiter, uint32_t state, const any &value) {
+    waiter.value_ = value;
+    if (waiter.state_.exchange(state, std::memory_order_release) == SettleWaiter::kSleeping)
+        wakeWord(waiter.state_);
+}
+}
+// A new waiter at the current end of the chain, so it sees what then() would see now.
+std::shared_ptr<promise::SettleWaiter> promise::Promise::settleWaiter() const {
+    std::shared_ptr<SettleWaiter> waiter = std::make_shared<SettleWaiter>();
+    // Keeps the outcome for handlers attached later; get() marks a rejection handled.
+    waiter->task_ = attachTask(*sharedPromise_, [waiter](const any &arg) {
+        settleWaiterWith(*waiter, SettleWaiter::kResolved, arg);
+        return ObserveOutcome();
+    }, [waiter](const any &arg) {
+        settleWaiterWith(*waiter, SettleWaiter::kRejected, arg);
+        return ObserveOutcome();
+    });
+    return waiter;
+}
+namespace promise {
+// Blocks until waiter is settled or timeout passed; returns whether it was settled.
+static inline bool waitSettled(SettleWaiter &waiter, std::chrono::milliseconds timeout) {
+    const bool forever = (timeout == std::chrono::milliseconds::max());
+    const auto deadline = (forever ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::now() + timeout);
+    uint32_t state = waiter.state_.load(std::memory_order_acquire);
+    while (state < SettleWaiter::kResolved) {
+        if (state == SettleWaiter::kPending
+            && !waiter.state_.compare_exchange_weak(state, SettleWaiter::kSleeping, std::memory_order_acquire))
+            continue;
+        if (forever) {
+            waitOnWord(waiter.state_, SettleWaiter::kSleeping, nullptr);
+        }
+        else {
+            std::chrono::nanoseconds remaining = deadline - std::chrono::steady_clock::now();
+            if (remaining.count() <= 0) return false;
+            waitOnWord(waiter.state_, SettleWaiter::kSleeping, &remaining);
+        }
+        state = waiter.state_.load(std::memory_order_acquire);
+    }
+    return true;
+}
+}
+bool promise::Promise::wait(std::chrono::milliseconds timeout) const {
+    if (!sharedPromise_) return false;
+    std::shared_ptr<SettleWaiter> waiter = settleWaiter();
+    if (waitSettled(*waiter, timeout)) return true;
+    // Timed out: take the waiter off the chain, so polling does not grow it.
+    if (std::shared_ptr<Task> task = waiter->task_.lock())
+        detachTask(task);
+    return waiter->state_.load(std::memory_order_acquire) >= SettleWaiter::kResolved;
+}
+promise::any promise::Promise::waitValue() const {
+    if (!sharedPromise_)
+        throw std::logic_error("get() on an empty promise");
+    std::shared_ptr<SettleWaiter> waiter = settleWaiter();
+    waitSettled(*waiter, std::chrono::milliseconds::max());
+    if (waiter->state_.load(std::memory_order_acquire) == SettleWaiter::kRejected) {
+        // The caller gets the rejection as an exception: it is handled from here on.
+        {
+            std::shared_ptr<PromiseHolder> promiseHolder;
+            HolderLock lock = lockHolder(*sharedPromise_, promiseHolder);
+            if (promiseHolder->state_ == TaskState::kRejected)
+                promiseHolder->handled_ = true;
+        }
+        waiter->value_.rethrow();
+    }
+    return waiter->value_;
+}
+promise::Promise promise::newPromise(const std::function<void(promise::Defer &defer)> &run, const std::source_location &location) {
+    Promise promise = newPromise(location);
+    Defer defer(promise.sharedPromise_->promiseHolder_.load()->pendingTasks_.front());
     try {
         run(defer);
     }
@@ -403,12 +1015,17 @@ promise::Promise promise::newPromise(const std::function<void(promise::Defer &de
     }
     return promise;
 }
-promise::Promise promise::newPromise() {
+promise::Promise promise::newPromise(const std::source_location &location) {
+    Promise promise;
+    promise.sharedPromise_ = pm_make_shared<SharedPromise, AllocKind::kSharedPromise>();
+    std::shared_ptr<PromiseHolder> promiseHolder = newHolder(promise.sharedPromise_);
+    promise.sharedPromise_->promiseHolder_.store(promiseHolder);
+    registerHolder(promiseHolder.get(), location);
+    return promise;
+}
+promise::Promise promise::lazyPromise(const std::function<void(promise::Defer &defer)> &run, const std::source_location &location) {
     Promise promise;
-    promise.sharedPromise_ = std::make_shared<SharedPromise>();
-    promise.sharedPromise_->promiseHolder_ = std::make_shared<PromiseHolder>();
-    promise.sharedPromise_->promiseHolder_->owners_.push_back(promise.sharedPromise_);
-    promise.then(any(), any());
+    promise.sharedPromise_ = pm_make_shared<LazySharedPromise, AllocKind::kSharedPromise>(run, location);
     return promise;
 }
 promise::Promise promise::doWhile(const std::function<void(promise::DeferLoop &loop)> &run) {
@@ -440,7 +1057,7 @@ promise::Promise promise::all(const std::list<promise::Promise> &promise_list) {
     if (promise_list.empty()) {
         return promise::resolve();
     }
-    auto finished = std::make_shared<size_t>(0);
+    auto finished = std::make_shared<std::atomic<size_t>>(0);
     auto size = promise_list.size();
     auto retArr = std::make_shared<std::vector<promise::any>>();
     retArr->resize(size);
@@ -0,0 +1,48 @@
+#pragma once
+#ifndef INC_PROMISE_REGISTRY_HPP_
+#define INC_PROMISE_REGISTRY_HPP_
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <source_location>
+#include "promise.hpp"
+namespace promise {
+struct RegistryEntry {
+    PromiseHolder                         *promiseHolder_;
+    std::source_location                  location_;
+    std::chrono::steady_clock::time_point createdAt_;
+    RegistryEntry                         *prev_;
+    RegistryEntry                         *next_;
+    size_t                                shard_;
+};
+struct PromiseInfo {
+    const void                             *promiseHolder_;
+    std::source_location                   location_;
+    std::chrono::steady_clock::duration    age_;
+    TaskState                              state_;
+    size_t                                 pendingTasks_;
+};
+// Opt-in registry of live PromiseHolders created by newPromise().
+// Holders are tracked in sharded intrusive lists; the shard is picked per
+// thread so registration from different threads does not contend.
+// Disabled by default; when disabled newPromise() pays one relaxed atomic load.
+struct PromiseRegistry {
+    static inline bool isEnabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+    // Only promises created while enabled are tracked.
+    PROMISE_API static void enable(bool enabled);
+    PROMISE_API static size_t size();
+    // Holders whose mutex is held by a running continuation are skipped, they are not stuck.
+    PROMISE_API static std::vector<PromiseInfo> list();
+    PROMISE_API static std::vector<PromiseInfo> pendingLongerThan(std::chrono::steady_clock::duration threshold);
+    PROMISE_API static void dumpPending(std::chrono::steady_clock::duration threshold, FILE *out = stderr);
+
+    PROMISE_API static void add(PromiseHolder *promiseHolder, const std::source_location &location);
+    PROMISE_API static void remove(RegistryEntry *entry);
+private:
+    inline static std::atomic<bool> enabled_{ false };
+};
+}
+#endif
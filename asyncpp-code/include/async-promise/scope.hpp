@@ -0,0 +1,143 @@
+#pragma once
+#ifndef INC_PROMISE_SCOPE_HPP_
+#define INC_PROMISE_SCOPE_HPP_
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "promise.hpp"
+namespace promise {
+// Structured concurrency: a Scope owns the child promises spawned into it.
+// join() resolves once every child has finished, or rejects with the first failure; the
+// first failure (or cancel()) cancels the children still running by rejecting them.
+// Children may spawn more children until the joined scope drains; after that spawn()
+// cancels the new child at once. Destroying the scope cancels what is still running, so
+// the state captured by its children is released with it.
+class Scope {
+    struct State {
+        std::mutex          mutex_;
+        std::list<Promise>  children_; // running children; size() is O(1)
+        std::vector<Defer>  waiters_;
+        any                 error_;
+        bool                failed_ = false;
+        bool                joined_ = false;
+        bool                done_ = false;
+    };
+public:
+    Scope()
+        : state_(std::make_shared<State>()) {
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() {
+        cancel(std::runtime_error("scope destroyed"));
+    }
+
+    // Starts func() as a child. func may return a value or a Promise. A drained or cancelled
+    // scope does not call func.
+    template<typename FUNC>
+    void spawn(FUNC &&func) {
+        if (isClosed()) return;
+        spawn(resolve().then(std::forward<FUNC>(func)));
+    }
+    // Adopts child, which belongs to the scope from now on: do not attach handlers to it.
+    void spawn(Promise child) {
+        std::list<Promise>::iterator it;
+        bool closed;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            closed = (state_->done_ || state_->failed_);
+            if (!closed)
+                it = state_->children_.insert(state_->children_.end(), child);
+        }
+        if (closed) {
+            child.fail([]() {});
+            child.reject(std::runtime_error("cancelled by scope"));
+            return;
+        }
+        std::shared_ptr<State> state = state_;
+        child.then([state, it]() {
+            finish(state, it, nullptr);
+        }, [state, it](const any &arg) {
+            finish(state, it, &arg);
+        });
+    }
+    // Settles once all children finished; no value on success, the first failure otherwise.
+    Promise join() {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        state_->joined_ = true;
+        if (state_->children_.empty()) {
+            state_->done_ = true;
+            return state_->failed_ ? reject(state_->error_) : resolve();
+        }
+        return newPromise([&](Defer &defer) {
+            state_->waiters_.push_back(defer);
+        });
+    }
+    // Cancels every running child; join() rejects with reason unless a child failed first.
+    void cancel(const any &reason) {
+        std::vector<Promise> running;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            if (!state_->failed_) {
+                state_->failed_ = true;
+                state_->error_ = reason;
+            }
+            running.assign(state_->children_.begin(), state_->children_.end());
+        }
+        for (const Promise &child : running)
+            child.reject(std::runtime_error("cancelled by scope"));
+    }
+    // Number of children still running.
+    size_t outstanding() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->children_.size();
+    }
+    bool isCancelled() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->failed_;
+    }
+    // Whether spawn() still takes children: false once the scope drained or was cancelled.
+    bool isClosed() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->done_ || state_->failed_;
+    }
+
+private:
+    static void finish(const std::shared_ptr<State> &state, std::list<Promise>::iterator it, const any *error) {
+        std::vector<Promise> running;
+        DeferBatch waiters;
+        bool failed = false;
+        any result;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            state->children_.erase(it);
+            if (error != nullptr && !state->failed_) {
+                state->failed_ = true;
+                state->error_ = *error;
+                running.assign(state->children_.begin(), state->children_.end());
+            }
+            if (state->joined_ && !state->done_ && state->children_.empty()) {
+                state->done_ = true;
+                for (const Defer &waiter : state->waiters_)
+                    waiters.add(waiter);
+                state->waiters_.clear();
+                failed = state->failed_;
+                result = state->error_;
+            }
+        }
+        for (const Promise &child : running)
+            child.reject(std::runtime_error("cancelled by scope"));
+        if (waiters.empty()) return;
+        if (failed)
+            waiters.reject(result);
+        else
+            waiters.resolve();
+    }
+
+    std::shared_ptr<State> state_;
+};
+}
+#endif
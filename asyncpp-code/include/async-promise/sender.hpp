@@ -0,0 +1,275 @@
+#pragma once
+#ifndef INC_PROMISE_SENDER_HPP_
+#define INC_PROMISE_SENDER_HPP_
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <stdexec/execution.hpp>
+#include "promise.hpp"
+#include "future.hpp"
+// P2300 adapters, built on stdexec (CMake option PROMISE_WITH_STDEXEC):
+//  - as_sender<T>(promise) completes with set_value(T) when promise resolves and with
+//    set_error(std::exception_ptr) when it rejects; a stop request cancels promise and
+//    completes with set_stopped().
+//  - from_sender(sender) starts sender and returns a Promise settled by its completion;
+//    cancelling that promise requests the sender to stop.
+//  - as_scheduler(executor) schedules on anything with execute(task), e.g. Service.
+namespace promise {
+namespace detail {
+template<typename T>
+struct SenderValue {
+    using type = stdexec::set_value_t(T);
+};
+template<>
+struct SenderValue<void> {
+    using type = stdexec::set_value_t();
+};
+
+template<typename T, typename RECEIVER>
+class PromiseOperation {
+    using StopToken = stdexec::stop_token_of_t<stdexec::env_of_t<RECEIVER>>;
+    struct OnStop {
+        void operator()() noexcept {
+            self_->stopped_.store(true, std::memory_order_release);
+            self_->promise_.reject(std::runtime_error("sender stopped"));
+        }
+        PromiseOperation *self_;
+    };
+public:
+    using operation_state_concept = stdexec::operation_state_t;
+    PromiseOperation(Promise promise, RECEIVER receiver)
+        : promise_(std::move(promise))
+        , receiver_(std::move(receiver)) {
+    }
+    PromiseOperation(const PromiseOperation &) = delete;
+    PromiseOperation &operator=(const PromiseOperation &) = delete;
+    // The operation lives until it completes, so the handlers may point to it. They complete
+    // once the promise is unlocked, as the stop callback locks it (see afterHandler()).
+    void start() & noexcept {
+        stopCallback_.emplace(stdexec::get_stop_token(stdexec::get_env(receiver_)), OnStop{ this });
+        PromiseOperation *self = this;
+        Promise promise = promise_;
+        promise.then([self](const any &arg) {
+            afterHandler([self, arg]() { self->complete(arg); });
+            return KeepOutcome();
+        }, [self](const any &arg) {
+            afterHandler([self, arg]() { self->fail(arg); });
+            return KeepOutcome();
+        });
+    }
+private:
+    void complete(const any &arg) noexcept {
+        stopCallback_.reset();
+        if constexpr (std::is_void_v<T>) {
+            stdexec::set_value(std::move(receiver_));
+        }
+        else if constexpr (std::is_same_v<T, any>) {
+            stdexec::set_value(std::move(receiver_), any(arg));
+        }
+        else {
+            std::optional<T> value;
+            try {
+                value.emplace(arg.cast<T>());
+            }
+            catch (...) {
+                stdexec::set_error(std::move(receiver_), std::current_exception());
+                return;
+            }
+            stdexec::set_value(std::move(receiver_), std::move(*value));
+        }
+    }
+    void fail(const any &arg) noexcept {
+        stopCallback_.reset();
+        if (stopped_.load(std::memory_order_acquire))
+            stdexec::set_stopped(std::move(receiver_));
+        else
+            stdexec::set_error(std::move(receiver_), toExceptionPtr(arg));
+    }
+    Promise                                                       promise_;
+    RECEIVER                                                      receiver_;
+    std::atomic<bool>                                             stopped_{ false };
+    std::optional<stdexec::stop_callback_for_t<StopToken, OnStop>> stopCallback_;
+};
+
+template<typename SENDER>
+struct SenderState;
+struct SenderEnv {
+    stdexec::inplace_stop_token query(stdexec::get_stop_token_t) const noexcept {
+        return token_;
+    }
+    stdexec::inplace_stop_token token_;
+};
+// Settles the promise of from_sender(), then frees the operation it is part of. Values are
+// copied into the promise first: they may live in the operation.
+template<typename SENDER>
+struct SenderReceiver {
+    using receiver_concept = stdexec::receiver_t;
+    template<typename ...ARGS>
+    void set_value(ARGS &&...args) && noexcept {
+        SenderState<SENDER> *state = state_;
+        state->defer_.resolve(std::forward<ARGS>(args)...);
+        delete state;
+    }
+    template<typename ERROR>
+    void set_error(ERROR &&error) && noexcept {
+        SenderState<SENDER> *state = state_;
+        state->defer_.reject(std::forward<ERROR>(error));
+        delete state;
+    }
+    void set_stopped() && noexcept {
+        SenderState<SENDER> *state = state_;
+        state->defer_.reject(std::runtime_error("sender stopped"));
+        delete state;
+    }
+    SenderEnv get_env() const noexcept {
+        return SenderEnv{ state_->stopSource_->get_token() };
+    }
+    SenderState<SENDER> *state_;
+};
+// Builds an immovable operation in place, through guaranteed copy elision.
+template<typename FUNC>
+struct EmplaceFrom {
+    operator std::invoke_result_t<FUNC &>() {
+        return func_();
+    }
+    FUNC func_;
+};
+template<typename SENDER>
+struct SenderState {
+    SenderState(const Defer &defer, const std::shared_ptr<stdexec::inplace_stop_source> &stopSource)
+        : defer_(defer)
+        , stopSource_(stopSource) {
+    }
+    Defer                                                                     defer_;
+    std::shared_ptr<stdexec::inplace_stop_source>                             stopSource_;
+    std::optional<stdexec::connect_result_t<SENDER, SenderReceiver<SENDER>>> operation_;
+};
+
+template<typename EXECUTOR, typename RECEIVER>
+class ScheduleOperation {
+public:
+    using operation_state_concept = stdexec::operation_state_t;
+    ScheduleOperation(EXECUTOR *executor, RECEIVER receiver)
+        : executor_(executor)
+        , receiver_(std::move(receiver)) {
+    }
+    ScheduleOperation(const ScheduleOperation &) = delete;
+    ScheduleOperation &operator=(const ScheduleOperation &) = delete;
+    void start() & noexcept {
+        try {
+            executor_->execute([this]() {
+                if (stdexec::get_stop_token(stdexec::get_env(receiver_)).stop_requested())
+                    stdexec::set_stopped(std::move(receiver_));
+                else
+                    stdexec::set_value(std::move(receiver_));
+            });
+        }
+        catch (...) {
+            stdexec::set_error(std::move(receiver_), std::current_exception());
+        }
+    }
+private:
+    EXECUTOR *executor_;
+    RECEIVER  receiver_;
+};
+}
+
+template<typename T = any>
+class PromiseSender {
+public:
+    using sender_concept = stdexec::sender_t;
+    using completion_signatures = stdexec::completion_signatures<
+        typename detail::SenderValue<T>::type,
+        stdexec::set_error_t(std::exception_ptr),
+        stdexec::set_stopped_t()>;
+    explicit PromiseSender(Promise promise)
+        : promise_(std::move(promise)) {
+    }
+    template<typename RECEIVER>
+    detail::PromiseOperation<T, RECEIVER> connect(RECEIVER receiver) const {
+        return detail::PromiseOperation<T, RECEIVER>(promise_, std::move(receiver));
+    }
+private:
+    Promise promise_;
+};
+
+template<typename T = any>
+inline PromiseSender<T> as_sender(Promise promise) {
+    return PromiseSender<T>(std::move(promise));
+}
+
+template<typename SENDER>
+inline Promise from_sender(SENDER &&sender) {
+    auto stopSource = std::make_shared<stdexec::inplace_stop_source>();
+    Promise promise = newPromise([&sender, &stopSource](Defer &defer) {
+        // Owned by the receiver once started: it may complete, and free it, inside start().
+        std::unique_ptr<detail::SenderState<SENDER>> state(new detail::SenderState<SENDER>(defer, stopSource));
+        detail::SenderState<SENDER> *raw = state.get();
+        auto connect = [&sender, raw]() {
+            return stdexec::connect(std::forward<SENDER>(sender), detail::SenderReceiver<SENDER>{ raw });
+        };
+        state->operation_.emplace(detail::EmplaceFrom<decltype(connect)>{ connect });
+        stdexec::start(*state.release()->operation_);
+    });
+    return promise.fail([stopSource](const any &) {
+        stopSource->request_stop();
+        return ObserveOutcome();
+    });
+}
+
+// schedule() completes with set_value() in a task posted to the executor, or with set_stopped()
+// if a stop was requested by then. The executor must outlive the scheduler and run the task.
+template<typename EXECUTOR>
+class ExecutorScheduler {
+public:
+    class Sender {
+    public:
+        using sender_concept = stdexec::sender_t;
+        using completion_signatures = stdexec::completion_signatures<
+            stdexec::set_value_t(),
+            stdexec::set_error_t(std::exception_ptr),
+            stdexec::set_stopped_t()>;
+        struct Env {
+            template<typename CPO>
+            ExecutorScheduler query(stdexec::get_completion_scheduler_t<CPO>) const noexcept {
+                return ExecutorScheduler(*executor_);
+            }
+            EXECUTOR *executor_;
+        };
+        explicit Sender(EXECUTOR *executor)
+            : executor_(executor) {
+        }
+        template<typename RECEIVER>
+        detail::ScheduleOperation<EXECUTOR, RECEIVER> connect(RECEIVER receiver) const {
+            return detail::ScheduleOperation<EXECUTOR, RECEIVER>(executor_, std::move(receiver));
+        }
+        Env get_env() const noexcept {
+            return Env{ executor_ };
+        }
+    private:
+        EXECUTOR *executor_;
+    };
+    explicit ExecutorScheduler(EXECUTOR &executor)
+        : executor_(&executor) {
+    }
+    Sender schedule() const noexcept {
+        return Sender(executor_);
+    }
+    bool operator==(const ExecutorScheduler &other) const noexcept {
+        return executor_ == other.executor_;
+    }
+private:
+    EXECUTOR *executor_;
+};
+
+template<typename EXECUTOR>
+inline ExecutorScheduler<EXECUTOR> as_scheduler(EXECUTOR &executor) {
+    return ExecutorScheduler<EXECUTOR>(executor);
+}
+}
+#endif
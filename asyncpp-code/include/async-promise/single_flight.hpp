@@ -0,0 +1,78 @@
+#pragma once
+#ifndef INC_PROMISE_SINGLE_FLIGHT_HPP_
+#define INC_PROMISE_SINGLE_FLIGHT_HPP_
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "promise.hpp"
+namespace promise {
+// Coalesces concurrent calls for the same key: while a call for `key` is in flight, later
+// callers wait for its result instead of starting their own.
+// Each caller gets its own Promise (chaining on a shared one would feed callers each other's
+// results), and all of them are settled together as one batch when the flight lands.
+template<typename Key, typename Hash = std::hash<Key>>
+class SingleFlight {
+    using Flight = std::vector<Defer>; // the callers waiting for one call
+    struct State {
+        std::mutex                                             mutex_;
+        std::unordered_map<Key, std::shared_ptr<Flight>, Hash> flights_;
+    };
+public:
+    SingleFlight()
+        : state_(std::make_shared<State>()) {
+    }
+
+    // factory() is called only if no call for key is in flight; it may return a value or a Promise.
+    template<typename FUNC>
+    Promise run(const Key &key, FUNC &&factory) {
+        std::shared_ptr<Flight> flight; // set for the caller that starts the call
+        Promise promise = newPromise([&](Defer &defer) {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            auto result = state_->flights_.try_emplace(key);
+            if (result.second) {
+                result.first->second = std::make_shared<Flight>();
+                flight = result.first->second;
+            }
+            result.first->second->push_back(defer);
+        });
+        if (flight) {
+            std::shared_ptr<State> state = state_;
+            resolve().then(std::forward<FUNC>(factory)).then([state, key, flight](const any &arg) {
+                resolveAll(land(*state, key, *flight), arg);
+            }, [state, key, flight](const any &arg) {
+                rejectAll(land(*state, key, *flight), arg);
+            });
+        }
+        return promise;
+    }
+    // Later calls for key start a new call instead of joining the one in flight, whose callers
+    // still get its result. For results that went stale while in flight.
+    void forget(const Key &key) {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        state_->flights_.erase(key);
+    }
+    bool inFlight(const Key &key) const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->flights_.count(key) != 0;
+    }
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->flights_.size();
+    }
+private:
+    // Callers join a flight under the lock while it is listed, so after this none can.
+    static Flight land(State &state, const Key &key, Flight &flight) {
+        std::lock_guard<std::mutex> lock(state.mutex_);
+        auto found = state.flights_.find(key);
+        if (found != state.flights_.end() && found->second.get() == &flight)
+            state.flights_.erase(found);
+        return std::move(flight);
+    }
+
+    std::shared_ptr<State> state_;
+};
+}
+#endif
@@ -0,0 +1,254 @@
+#pragma once
+#ifndef INC_PROMISE_SYNC_HPP_
+#define INC_PROMISE_SYNC_HPP_
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include "promise.hpp"
+// Non-blocking synchronization primitives: waiting returns a Promise instead of parking a thread.
+// Waiters are served in FIFO order and permits are handed straight to the next waiter, so a
+// release() never lets a later acquire() overtake a queued one.
+// Pending waiters are rejected when the object is destroyed.
+namespace promise {
+class AsyncSemaphore {
+    struct Waiter {
+        Defer  defer_;
+        size_t permits_;
+    };
+public:
+    explicit AsyncSemaphore(size_t permits)
+        : permits_(permits) {
+    }
+    AsyncSemaphore(const AsyncSemaphore &) = delete;
+    AsyncSemaphore &operator=(const AsyncSemaphore &) = delete;
+    ~AsyncSemaphore() {
+        DeferBatch waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const Waiter &waiter : waiters_)
+                waiters.add(waiter.defer_);
+            waiters_.clear();
+        }
+        waiters.reject(std::runtime_error("semaphore destroyed"));
+    }
+
+    // Resolves once `permits` permits are held by the caller.
+    // Promises are made with the lock released, as their continuations may call release().
+    Promise acquire(size_t permits = 1) {
+        std::optional<Defer> defer; // for the promise of an acquire that has to wait
+        Promise waiting;
+        while (true) {
+            bool granted = false;
+            bool queued = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (waiters_.empty() && permits_ >= permits) {
+                    permits_ -= permits;
+                    granted = true;
+                }
+                else if (defer) {
+                    waiters_.push_back(Waiter{ *defer, permits });
+                    queued = true;
+                }
+            }
+            if (queued)
+                return waiting;
+            if (!granted) {
+                waiting = newPromise([&defer](Defer &pending) {
+                    defer = pending;
+                });
+                continue;
+            }
+            if (!defer)
+                return resolve();
+            defer->resolve();
+            return waiting;
+        }
+    }
+    bool tryAcquire(size_t permits = 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!waiters_.empty() || permits_ < permits)
+            return false;
+        permits_ -= permits;
+        return true;
+    }
+    void release(size_t permits = 1) {
+        DeferBatch granted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            permits_ += permits;
+            while (!waiters_.empty() && permits_ >= waiters_.front().permits_) {
+                permits_ -= waiters_.front().permits_;
+                granted.add(waiters_.front().defer_);
+                waiters_.pop_front();
+            }
+        }
+        granted.resolve();
+    }
+    // Acquires, runs func (which may return a Promise) and releases when it settles.
+    template<typename FUNC>
+    Promise run(FUNC &&func, size_t permits = 1) {
+        return acquire(permits).then([this, permits, func = std::forward<FUNC>(func)]() {
+            return resolve().then(func).finally([this, permits]() {
+                release(permits);
+            });
+        });
+    }
+    size_t available() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return permits_;
+    }
+    size_t waiting() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return waiters_.size();
+    }
+private:
+    mutable std::mutex mutex_;
+    size_t             permits_;
+    std::deque<Waiter> waiters_;
+};
+
+class AsyncMutex {
+public:
+    AsyncMutex()
+        : semaphore_(1) {
+    }
+    // Resolves when the caller owns the mutex; the owner must call unlock().
+    Promise lock() {
+        return semaphore_.acquire();
+    }
+    bool tryLock() {
+        return semaphore_.tryAcquire();
+    }
+    // Ownership passes directly to the oldest waiter, if any.
+    void unlock() {
+        semaphore_.release();
+    }
+    template<typename FUNC>
+    Promise run(FUNC &&func) {
+        return semaphore_.run(std::forward<FUNC>(func));
+    }
+private:
+    AsyncSemaphore semaphore_;
+};
+
+// Single use: wait() resolves once countDown() was called `count` times.
+class AsyncLatch {
+public:
+    explicit AsyncLatch(size_t count)
+        : count_(count) {
+    }
+    AsyncLatch(const AsyncLatch &) = delete;
+    AsyncLatch &operator=(const AsyncLatch &) = delete;
+    ~AsyncLatch() {
+        DeferBatch waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            waiters.reserve(waiters_.size());
+            for (const Defer &defer : waiters_)
+                waiters.add(defer);
+            waiters_.clear();
+        }
+        waiters.reject(std::runtime_error("latch destroyed"));
+    }
+    void countDown(size_t n = 1) {
+        DeferBatch released;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (count_ == 0) return;
+            count_ = (n >= count_ ? 0 : count_ - n);
+            if (count_ != 0) return;
+            for (const Defer &defer : waiters_)
+                released.add(defer);
+            waiters_.clear();
+        }
+        released.resolve();
+    }
+    Promise wait() {
+        if (tryWait())
+            return resolve();
+        std::optional<Defer> defer;
+        Promise promise = newPromise([&defer](Defer &pending) {
+            defer = pending;
+        });
+        bool released;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            released = (count_ == 0);
+            if (!released)
+                waiters_.push_back(*defer);
+        }
+        if (released)
+            defer->resolve();
+        return promise;
+    }
+    Promise arriveAndWait(size_t n = 1) {
+        countDown(n);
+        return wait();
+    }
+    bool tryWait() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_ == 0;
+    }
+private:
+    mutable std::mutex mutex_;
+    size_t             count_;
+    std::deque<Defer>  waiters_;
+};
+
+// Reusable: each phase completes when `parties` callers have arrived, and their
+// arriveAndWait() promises resolve with the number of the completed phase.
+class AsyncBarrier {
+public:
+    explicit AsyncBarrier(size_t parties)
+        : parties_(parties)
+        , phase_(0) {
+        if (parties == 0)
+            throw std::invalid_argument("AsyncBarrier needs at least one party");
+    }
+    AsyncBarrier(const AsyncBarrier &) = delete;
+    AsyncBarrier &operator=(const AsyncBarrier &) = delete;
+    ~AsyncBarrier() {
+        DeferBatch waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const Defer &defer : arrived_)
+                waiters.add(defer);
+            arrived_.clear();
+        }
+        waiters.reject(std::runtime_error("barrier destroyed"));
+    }
+    Promise arriveAndWait() {
+        std::optional<Defer> defer;
+        Promise promise = newPromise([&defer](Defer &pending) {
+            defer = pending;
+        });
+        DeferBatch released;
+        size_t phase = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            arrived_.push_back(*defer);
+            if (arrived_.size() >= parties_) {
+                phase = phase_++;
+                released.reserve(arrived_.size());
+                for (const Defer &arrived : arrived_)
+                    released.add(arrived);
+                arrived_.clear();
+            }
+        }
+        released.resolve(phase);
+        return promise;
+    }
+    size_t phase() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return phase_;
+    }
+private:
+    mutable std::mutex mutex_;
+    const size_t       parties_;
+    size_t             phase_;
+    std::deque<Defer>  arrived_;
+};
+}
+#endif
@@ -0,0 +1,258 @@
+#pragma once
+#ifndef INC_PROMISE_TASK_GRAPH_HPP_
+#define INC_PROMISE_TASK_GRAPH_HPP_
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "promise.hpp"
+namespace promise {
+// Dependency graph of asynchronous steps. Each node is a function returning a Promise, called
+// with the results of its dependencies (in addEdge() order) as soon as the last of them has
+// resolved, so independent branches overlap instead of waiting on each other as nested
+// then()/all() would make them. Node functions are started through an Executor (Service,
+// ThreadPool, ...), or inline. After run() settles, stats() reports when each node ran and the
+// critical path: the chain of nodes, each gated by the previous one, that ended last.
+class TaskGraph {
+public:
+    using NodeId   = size_t;
+    using Clock    = std::chrono::steady_clock;
+    using NodeFunc = std::function<Promise(const std::vector<any> &inputs)>;
+    static constexpr NodeId kNoNode = std::numeric_limits<NodeId>::max();
+
+    struct NodeStats {
+        std::string     name_;
+        bool            finished_;  // resolved; false if it failed or never started
+        Clock::duration startedAt_; // since run()
+        Clock::duration duration_;  // from the call of its function until its Promise settled
+    };
+    struct Stats {
+        std::vector<NodeStats> nodes_;        // indexed by NodeId
+        std::vector<NodeId>    criticalPath_; // from a root to the last node to finish
+        Clock::duration        total_;
+    };
+private:
+    struct Node {
+        std::string         name_;
+        NodeFunc            func_;
+        std::vector<NodeId> dependencies_;
+        std::vector<NodeId> dependents_;
+        size_t              waiting_;  // dependencies not resolved yet
+        NodeId              gatedBy_;  // the dependency whose completion started this node
+        any                 result_;
+        Clock::time_point   startedAt_;
+        Clock::time_point   finishedAt_;
+        bool                started_;
+        bool                finished_;
+    };
+    struct State {
+        std::mutex                                         mutex_;
+        std::vector<Node>                                  nodes_;
+        std::function<void(std::function<void()> task)>    execute_;
+        std::optional<Defer>                               done_;
+        size_t                                             remaining_ = 0;
+        bool                                               ran_ = false;
+        bool                                               failed_ = false;
+        Clock::time_point                                  begin_;
+        Clock::time_point                                  end_;
+    };
+public:
+    TaskGraph()
+        : state_(std::make_shared<State>()) {
+    }
+    TaskGraph(const TaskGraph &) = delete;
+    TaskGraph &operator=(const TaskGraph &) = delete;
+
+    // The graph is built before run(): adding to it afterwards throws std::logic_error.
+    NodeId addNode(std::string name, NodeFunc func) {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        if (state_->ran_)
+            throw std::logic_error("task graph already ran");
+        state_->nodes_.push_back(Node{ std::move(name), std::move(func), {}, {}, 0, kNoNode, any(),
+                                       Clock::time_point(), Clock::time_point(), false, false });
+        return state_->nodes_.size() - 1;
+    }
+    // to starts after from has resolved, and receives its result.
+    void addEdge(NodeId from, NodeId to) {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        if (from >= state_->nodes_.size() || to >= state_->nodes_.size())
+            throw std::out_of_range("task graph has no such node");
+        if (state_->ran_)
+            throw std::logic_error("task graph already ran");
+        state_->nodes_[to].dependencies_.push_back(from);
+        state_->nodes_[from].dependents_.push_back(to);
+    }
+
+    // Starts the nodes without dependencies, calling every node function through executor,
+    // which must outlive the run. Resolves once every node has resolved; rejects with the first
+    // node failure, after which no more nodes are started. A graph runs once.
+    template<Executor EXECUTOR>
+    Promise run(EXECUTOR &executor) {
+        return start([&executor](std::function<void()> task) {
+            executor.execute(std::move(task));
+        });
+    }
+    // Like run(executor), calling node functions inline on the thread that makes them ready.
+    Promise run() {
+        return start([](std::function<void()> task) {
+            task();
+        });
+    }
+
+    // The result a node resolved with; empty until then.
+    any result(NodeId node) const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        return state_->nodes_.at(node).result_;
+    }
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(state_->mutex_);
+        const State &state = *state_;
+        Stats stats;
+        stats.nodes_.reserve(state.nodes_.size());
+        NodeId last = kNoNode;
+        for (NodeId id = 0; id < state.nodes_.size(); ++id) {
+            const Node &node = state.nodes_[id];
+            stats.nodes_.push_back(NodeStats{ node.name_, node.finished_,
+                node.started_ ? node.startedAt_ - state.begin_ : Clock::duration::zero(),
+                node.finished_ ? node.finishedAt_ - node.startedAt_ : Clock::duration::zero() });
+            if (node.finished_ && (last == kNoNode || node.finishedAt_ > state.nodes_[last].finishedAt_))
+                last = id;
+        }
+        for (NodeId id = last; id != kNoNode; id = state.nodes_[id].gatedBy_)
+            stats.criticalPath_.push_back(id);
+        std::reverse(stats.criticalPath_.begin(), stats.criticalPath_.end());
+        stats.total_ = (state.end_ > state.begin_ ? state.end_ - state.begin_ : Clock::duration::zero());
+        return stats;
+    }
+
+private:
+    Promise start(std::function<void(std::function<void()> task)> execute) {
+        std::vector<NodeId> roots;
+        Promise promise = newPromise([&](Defer &defer) {
+            std::lock_guard<std::mutex> lock(state_->mutex_);
+            State &state = *state_;
+            if (state.ran_) {
+                defer.reject(std::runtime_error("task graph already ran"));
+                return;
+            }
+            state.ran_ = true;
+            state.begin_ = state.end_ = Clock::now();
+            for (Node &node : state.nodes_) {
+                node.waiting_ = node.dependencies_.size();
+                if (node.waiting_ == 0) roots.push_back(&node - state.nodes_.data());
+            }
+            if (!acyclic(state, roots)) {
+                roots.clear();
+                defer.reject(std::runtime_error("task graph has a cycle"));
+                return;
+            }
+            if (state.nodes_.empty()) {
+                defer.resolve();
+                return;
+            }
+            state.execute_ = std::move(execute);
+            state.remaining_ = state.nodes_.size();
+            state.done_.emplace(defer);
+        });
+        for (NodeId id : roots)
+            launch(state_, id);
+        return promise;
+    }
+    // Kahn's algorithm over the dependency counts, without consuming them.
+    static bool acyclic(const State &state, const std::vector<NodeId> &roots) {
+        std::vector<size_t> waiting(state.nodes_.size());
+        for (NodeId id = 0; id < state.nodes_.size(); ++id)
+            waiting[id] = state.nodes_[id].dependencies_.size();
+        std::vector<NodeId> ready = roots;
+        size_t visited = 0;
+        while (!ready.empty()) {
+            NodeId id = ready.back();
+            ready.pop_back();
+            ++visited;
+            for (NodeId dependent : state.nodes_[id].dependents_)
+                if (--waiting[dependent] == 0) ready.push_back(dependent);
+        }
+        return visited == state.nodes_.size();
+    }
+    static void launch(const std::shared_ptr<State> &state, NodeId id) {
+        state->execute_([state, id]() {
+            std::vector<any> inputs;
+            NodeFunc func;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                if (state->failed_) return;
+                Node &node = state->nodes_[id];
+                inputs.reserve(node.dependencies_.size());
+                for (NodeId dependency : node.dependencies_)
+                    inputs.push_back(state->nodes_[dependency].result_);
+                func = node.func_;
+                node.started_ = true;
+                node.startedAt_ = Clock::now();
+            }
+            Promise promise;
+            try {
+                promise = func(inputs);
+            }
+            catch (...) {
+                finish(state, id, false, any(std::current_exception()));
+                return;
+            }
+            promise.then([state, id](const any &arg) {
+                finish(state, id, true, arg);
+            }, [state, id](const any &arg) {
+                finish(state, id, false, arg);
+            });
+        });
+    }
+    static void finish(const std::shared_ptr<State> &state, NodeId id, bool resolved, const any &arg) {
+        std::vector<NodeId> ready;
+        std::optional<Defer> done;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            Node &node = state->nodes_[id];
+            node.finishedAt_ = Clock::now();
+            if (state->failed_) return;
+            if (!resolved) {
+                state->failed_ = true;
+                state->end_ = node.finishedAt_;
+                done.swap(state->done_);
+            }
+            else {
+                node.result_ = arg;
+                node.finished_ = true;
+                for (NodeId dependent : node.dependents_) {
+                    Node &next = state->nodes_[dependent];
+                    if (--next.waiting_ == 0) {
+                        next.gatedBy_ = id;
+                        ready.push_back(dependent);
+                    }
+                }
+                if (--state->remaining_ == 0) {
+                    state->end_ = node.finishedAt_;
+                    done.swap(state->done_);
+                }
+            }
+        }
+        if (done) {
+            if (resolved)
+                done->resolve();
+            else
+                done->reject(arg);
+            return;
+        }
+        for (NodeId dependent : ready)
+            launch(state, dependent);
+    }
+
+    std::shared_ptr<State> state_;
+};
+}
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef INC_PROMISE_TRACE_HPP_
+#define INC_PROMISE_TRACE_HPP_
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "promise.hpp"
+namespace promise {
+struct TraceState;
+enum class TraceEvent : uint8_t {
+    kCreate,
+    kContinuationBegin,
+    kContinuationEnd,
+    kSettle,
+    kJoin
+};
+struct TraceRecord {
+    TraceEvent  event_;
+    TaskState   state_;
+    uint32_t    threadId_;
+    uint64_t    timestampNs_;
+    const void *promiseHolder_;
+    // Task for continuation and settle events, the absorbed PromiseHolder for kJoin.
+    const void *peer_;
+};
+// Records promise lifecycle events into per-thread ring buffers. Off by default; define
+// PROMISE_DISABLE_TRACE to compile the hooks out.
+struct Tracer {
+    static inline bool isEnabled() {
+#ifdef PROMISE_DISABLE_TRACE
+        return false;
+#else
+        return enabled_.load(std::memory_order_relaxed);
+#endif
+    }
+    PROMISE_API static void enable(bool enabled);
+    // Capacity (in records) of ring buffers created after this call.
+    PROMISE_API static void setBufferSize(size_t records);
+    // Both clear() and snapshot() are meant to be called while no other thread is tracing.
+    PROMISE_API static void clear();
+    PROMISE_API static std::vector<TraceRecord> snapshot();
+    PROMISE_API static void dumpChromeTrace(std::ostream &out);
+    PROMISE_API static std::string dumpChromeTrace();
+    PROMISE_API static void record(TraceEvent event, const void *promiseHolder, const void *peer, TaskState state);
+private:
+    PROMISE_API static TraceState &state();
+    // Inline in the header, so isEnabled() compiles to the load itself.
+    inline static std::atomic<bool> enabled_{ false };
+};
+}
+#endif